@@ -3,8 +3,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include "roff.h"
 
+#define NFPGAP		256	/* new positions may follow the last by this much */
+
 static char dev_dir[PATHLEN];	/* device directory */
 static char dev_dev[PATHLEN];	/* output device name */
 int dev_res;			/* device resolution */
@@ -13,14 +16,23 @@ int dev_hor;			/* minimum horizontal movement */
 int dev_ver;			/* minimum vertical movement */
 
 /* mounted fonts */
-static char fn_name[NFONTS][FNLEN];	/* font names */
-static struct font *fn_font[NFONTS];	/* font structs */
+static char (*fn_name)[FNLEN];		/* font names */
+static char (*fn_path)[PATHLEN];	/* font paths; fonts are opened lazily */
+static int *fn_special;			/* special fonts; -1 if not known yet */
+static struct font **fn_font;		/* font structs, once opened */
+static struct dict **fn_gdict;		/* character name to fn_gl[] index */
 static int fn_n;			/* number of device fonts */
+static int fn_sz;			/* number of font positions */
+
+/* resolved glyphs for each font position */
+static struct glyph **fn_gl;		/* resolved glyphs; NULL if missing */
+static int fn_gl_n, fn_gl_sz;
 
 /* .fspecial request */
-static char fspecial_fn[NFONTS][FNLEN];	/* .fspecial first arguments */
-static char fspecial_sp[NFONTS][FNLEN];	/* .fspecial special fonts */
+static char (*fspecial_fn)[FNLEN];	/* .fspecial first arguments */
+static char (*fspecial_sp)[FNLEN];	/* .fspecial special fonts */
 static int fspecial_n;			/* number of fonts in fspecial_sp[] */
+static int fspecial_sz;
 
 static void skipline(FILE* filp)
 {
@@ -37,44 +49,62 @@ static void dev_prologue(void)
 	out("x init\n");
 }
 
+/* make room for font positions [0, n) */
+static void dev_extend(int n)
+{
+	int sz = fn_sz;
+	if (n <= sz)
+		return;
+	fn_sz = MAX(n, sz ? sz * 2 : 32);
+	fn_name = mextend(fn_name, sz, fn_sz, sizeof(fn_name[0]));
+	fn_path = mextend(fn_path, sz, fn_sz, sizeof(fn_path[0]));
+	fn_special = mextend(fn_special, sz, fn_sz, sizeof(fn_special[0]));
+	fn_font = mextend(fn_font, sz, fn_sz, sizeof(fn_font[0]));
+	fn_gdict = mextend(fn_gdict, sz, fn_sz, sizeof(fn_gdict[0]));
+}
+
 /* find a position for the given font */
 static int dev_position(char *id)
 {
 	int i;
-	for (i = 1; i < NFONTS; i++)	/* already mounted */
+	for (i = 1; i < fn_sz; i++)	/* already mounted */
 		if (!strcmp(fn_name[i], id))
 			return i;
-	for (i = 1; i < NFONTS; i++)	/* the first empty position */
-		if (!fn_font[i])
+	for (i = 1; i < fn_sz; i++)	/* the first empty position */
+		if (!fn_path[i][0])
 			return i;
-	return 0;			/* no room left */
+	return MAX(1, fn_sz);		/* a new position */
 }
 
+/* mount a font; it is opened when first accessed via dev_font() */
 int dev_mnt(int pos, char *id, char *name)
 {
 	char path[PATHLEN];
-	struct font *fn;
-	if (pos >= NFONTS)
+	if (pos >= MAX(fn_sz, fn_n) + NFPGAP)
 		return -1;
 	if (strchr(name, '/'))
 		snprintf(path, sizeof(path), "%s", name);
 	else
 		snprintf(path, sizeof(path), "%s/dev%s/%s", dev_dir, dev_dev, name);
-	fn = font_open(path);
-	if (!fn)
+	if (access(path, R_OK))
 		return -1;
 	if (pos < 0)
 		pos = dev_position(id);
+	dev_extend(pos + 1);
 	if (fn_font[pos])
 		font_close(fn_font[pos]);
+	fn_font[pos] = NULL;
 	if (fn_name[pos] != name)	/* ignore if fn_name[pos] is passed */
 		snprintf(fn_name[pos], sizeof(fn_name[pos]), "%s", id);
-	fn_font[pos] = fn;
+	snprintf(fn_path[pos], sizeof(fn_path[pos]), "%s", path);
+	fn_special[pos] = -1;		/* checked in dev_special() */
+	dev_gclear();
 	out("x font %d %s\n", pos, name);
 	return pos;
 }
 
-int dev_open(char *dir, char *dev)
+/* open the device; with jobs > 1, load its fonts in parallel */
+int dev_open(char *dir, char *dev, int jobs)
 {
 	char path[PATHLEN];
 	char tok[128];
@@ -93,6 +123,7 @@ int dev_open(char *dir, char *dev)
 		}
 		if (!strcmp("fonts", tok)) {
 			fscanf(desc, "%d", &fn_n);
+			dev_extend(MAX(0, fn_n) + 1);
 			for (i = 0; i < fn_n; i++)
 				fscanf(desc, "%s", fn_name[i + 1]);
 			fn_n++;
@@ -132,6 +163,18 @@ int dev_open(char *dir, char *dev)
 			return 1;
 		}
 	}
+	if (jobs > 1) {
+		char **paths = xmalloc(fn_n * sizeof(paths[0]));
+		int n = 0;
+		for (i = 0; i < fn_n; i++)
+			if (fn_path[i][0])
+				paths[n++] = fn_path[i];
+		font_preload(paths, n, jobs);
+		free(paths);
+		for (i = 0; i < fn_n; i++)
+			if (fn_path[i][0])
+				dev_font(i);
+	}
 	return 0;
 }
 
@@ -145,44 +188,95 @@ void dev_close(void)
 {
 	int i;
 	dev_epilogue();
-	for (i = 0; i < NFONTS; i++) {
+	for (i = 0; i < fn_sz; i++) {
 		if (fn_font[i])
 			font_close(fn_font[i]);
 		fn_font[i] = NULL;
+		fn_path[i][0] = '\0';
 	}
+	font_done();
+	dev_gclear();
+	free(fn_name);
+	free(fn_path);
+	free(fn_special);
+	free(fn_font);
+	free(fn_gdict);
+	free(fspecial_fn);
+	free(fspecial_sp);
+	fn_sz = 0;
 }
 
 /* glyph handling functions */
 
+/* return nonzero if the font at pos is special; read its header if unopened */
+static int dev_special(int pos)
+{
+	if (fn_special[pos] < 0)
+		fn_special[pos] = fn_font[pos] ? font_special(fn_font[pos]) :
+			font_isspecial(fn_path[pos]) > 0;
+	return fn_special[pos];
+}
+
 static struct glyph *dev_find(char *c, int fn, int byid)
 {
 	struct glyph *(*find)(struct font *fn, char *name);
 	struct glyph *g;
 	int i;
 	find = byid ? font_glyph : font_find;
-	if ((g = find(fn_font[fn], c)))
+	if ((g = find(dev_font(fn), c)))
 		return g;
 	for (i = 0; i < fspecial_n; i++)
 		if (dev_pos(fspecial_fn[i]) == fn && dev_pos(fspecial_sp[i]) >= 0)
 			if ((g = find(dev_font(dev_pos(fspecial_sp[i])), c)))
 				return g;
-	for (i = 0; i < NFONTS; i++)
-		if (fn_font[i] && font_special(fn_font[i]))
-			if ((g = find(fn_font[i], c)))
+	for (i = 0; i < fn_sz; i++)
+		if (fn_path[i][0] && dev_special(i))
+			if ((g = find(dev_font(i), c)))
 				return g;
 	return NULL;
 }
 
+/* forget resolved glyphs; called when fonts or their mappings change */
+void dev_gclear(void)
+{
+	int i;
+	for (i = 0; i < fn_sz; i++) {
+		if (fn_gdict[i])
+			dict_free(fn_gdict[i]);
+		fn_gdict[i] = NULL;
+	}
+	free(fn_gl);
+	fn_gl = NULL;
+	fn_gl_n = 0;
+	fn_gl_sz = 0;
+}
+
 struct glyph *dev_glyph(char *c, int fn)
 {
+	struct glyph *g;
+	int i;
 	if ((c[0] == c_ec || c[0] == c_ni) && c[1] == c_ec)
 		c++;
 	if (c[0] == c_ec && c[1] == '(')
 		c += 2;
 	c = cmap_map(c);
+	if (fn < 0 || fn >= fn_sz)
+		return dev_find(c, fn, 0);
+	if (fn_gdict[fn] && (i = dict_get(fn_gdict[fn], c)) >= 0)
+		return fn_gl[i];
 	if (!strncmp("GID=", c, 4))
-		return dev_find(c + 4, fn, 1);
-	return dev_find(c, fn, 0);
+		g = dev_find(c + 4, fn, 1);
+	else
+		g = dev_find(c, fn, 0);
+	if (!fn_gdict[fn])	/* dev_find() may mount fonts */
+		fn_gdict[fn] = dict_make(-1, 1);
+	if (fn_gl_n == fn_gl_sz) {
+		fn_gl_sz = fn_gl_sz + 1024;
+		fn_gl = mextend(fn_gl, fn_gl_n, fn_gl_sz, sizeof(fn_gl[0]));
+	}
+	fn_gl[fn_gl_n] = g;
+	dict_put(fn_gdict[fn], c, fn_gl_n++);
+	return g;
 }
 
 /* return the mounted position of a font */
@@ -191,16 +285,16 @@ int dev_pos(char *id)
 	int i;
 	if (isdigit(id[0])) {
 		int num = atoi(id);
-		if (num < 0 || num >= NFONTS || !fn_font[num]) {
+		if (num < 0 || num >= fn_sz || !fn_path[num][0]) {
 			errmsg("neatroff: bad font position %s\n", id);
 			return -1;
 		}
 		return num;
 	}
-	for (i = 1; i < NFONTS; i++)
+	for (i = 1; i < fn_sz; i++)
 		if (!strcmp(fn_name[i], id))
 			return i;
-	if (!strcmp(fn_name[0], id))
+	if (fn_sz && !strcmp(fn_name[0], id))
 		return 0;
 	return dev_mnt(0, id, id);
 }
@@ -209,28 +303,44 @@ int dev_pos(char *id)
 int dev_fontpos(struct font *fn)
 {
 	int i;
-	for (i = 0; i < NFONTS; i++)
+	for (i = 0; i < fn_sz; i++)
 		if (fn_font[i] == fn)
 			return i;
 	return 0;
 }
 
-/* return the font struct at pos */
+/* return the font struct at pos; open the font if necessary */
 struct font *dev_font(int pos)
 {
-	return pos >= 0 && pos < NFONTS ? fn_font[pos] : NULL;
+	if (pos < 0 || pos >= fn_sz || !fn_path[pos][0])
+		return NULL;
+	if (!fn_font[pos] && !(fn_font[pos] = font_open(fn_path[pos]))) {
+		errmsg("neatroff: cannot open font %s\n", fn_path[pos]);
+		fn_path[pos][0] = '\0';
+		dev_gclear();
+	}
+	return fn_font[pos];
 }
 
 void tr_fspecial(char **args)
 {
 	char *fn = args[1];
 	int i;
+	dev_gclear();
 	if (!fn) {
 		fspecial_n = 0;
 		return;
 	}
 	for (i = 2; i < NARGS; i++) {
-		if (args[i] && fspecial_n < LEN(fspecial_fn)) {
+		if (args[i]) {
+			if (fspecial_n == fspecial_sz) {
+				int sz = fspecial_sz;
+				fspecial_sz = sz + 32;
+				fspecial_fn = mextend(fspecial_fn, sz, fspecial_sz,
+					sizeof(fspecial_fn[0]));
+				fspecial_sp = mextend(fspecial_sp, sz, fspecial_sz,
+					sizeof(fspecial_sp[0]));
+			}
 			snprintf(fspecial_fn[fspecial_n],
 				sizeof(fspecial_fn[fspecial_n]), "%s", fn);
 			snprintf(fspecial_sp[fspecial_n],
@@ -1,25 +1,33 @@
+/* dictionaries: open-addressing hash tables mapping strings to integers */
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "roff.h"
 
-#define CNTMIN		(1 << 10)
+#define DICTMIN		64		/* the initial number of entries */
+#define ARENASZ		(1 << 14)	/* the size of key arena blocks */
 
 struct dict {
-	struct iset *map;
+	int *tab;		/* hash table slots; the latest entry for each key */
+	int slots;		/* the number of slots (a power of two) */
+	int used;		/* the number of occupied slots */
 	char **key;
 	int *val;
+	unsigned *hash;		/* the hash of each entry */
 	int size;
 	int n;
 	int notfound;		/* the value returned for missing keys */
-	int hashlen;		/* the number of characters used for hashing */
 	int dupkeys;		/* duplicate keys if set */
+	char **blk;		/* key arena blocks */
+	int blk_n;
+	int blk_used;		/* the used bytes of the last block */
 };
 
 static void dict_extend(struct dict *d, int size)
 {
 	d->key = mextend(d->key, d->size, size, sizeof(d->key[0]));
 	d->val = mextend(d->val, d->size, size, sizeof(d->val[0]));
+	d->hash = mextend(d->hash, d->size, size, sizeof(d->hash[0]));
 	d->size = size;
 }
 
@@ -28,69 +36,120 @@ static void dict_extend(struct dict *d, int size)
  *
  * notfound: the value returned for missing keys.
  * dupkeys: if nonzero, store a copy of keys inserted via dict_put().
- * hashlen: the number of characters used for hashing
  */
-struct dict *dict_make(int notfound, int dupkeys, int hashlen)
+struct dict *dict_make(int notfound, int dupkeys)
 {
 	struct dict *d = xmalloc(sizeof(*d));
 	memset(d, 0, sizeof(*d));
 	d->n = 1;
-	d->hashlen = hashlen ? hashlen : 32;
 	d->dupkeys = dupkeys;
 	d->notfound = notfound;
-	d->map = iset_make();
-	dict_extend(d, CNTMIN);
+	d->slots = DICTMIN * 2;
+	d->tab = mextend(NULL, 0, d->slots, sizeof(d->tab[0]));
+	dict_extend(d, DICTMIN);
 	return d;
 }
 
 void dict_free(struct dict *d)
 {
 	int i;
-	if (d->dupkeys)
-		for (i = 0; i < d->size; i++)
-			free(d->key[i]);
+	for (i = 0; i < d->blk_n; i++)
+		free(d->blk[i]);
+	free(d->blk);
+	free(d->tab);
 	free(d->val);
 	free(d->key);
-	iset_free(d->map);
+	free(d->hash);
 	free(d);
 }
 
-static int dict_hash(struct dict *d, char *key)
+/* FNV-1a */
+#define HASHBEG		2166136261u
+#define HASHADD(h, c)	(((h) ^ (unsigned char) (c)) * 16777619u)
+
+static unsigned dict_hash(char *key)
+{
+	unsigned h = HASHBEG;
+	while (*key)
+		h = HASHADD(h, *key++);
+	return h;
+}
+
+/* the slot of key or the empty slot for inserting it */
+static int dict_slot(struct dict *d, char *key, unsigned h)
 {
-	unsigned long hash = (unsigned char) *key++;
-	int i = d->hashlen;
-	while (--i > 0 && *key)
-		hash = (hash << 5) + hash + (unsigned char) *key++;
-	return hash & 0x3ff;
+	int i = h & (d->slots - 1);
+	while (d->tab[i]) {
+		int idx = d->tab[i];
+		if (d->hash[idx] == h && !strcmp(d->key[idx], key))
+			return i;
+		i = (i + 1) & (d->slots - 1);
+	}
+	return i;
+}
+
+static void dict_rehash(struct dict *d, int slots)
+{
+	int *tab = d->tab;
+	int old = d->slots;
+	int i;
+	d->tab = mextend(NULL, 0, slots, sizeof(d->tab[0]));
+	d->slots = slots;
+	for (i = 0; i < old; i++) {
+		if (tab[i]) {
+			int j = tab[i];
+			int k = d->hash[j] & (slots - 1);
+			while (d->tab[k])
+				k = (k + 1) & (slots - 1);
+			d->tab[k] = j;
+		}
+	}
+	free(tab);
+}
+
+/* copy key into the arena */
+static char *dict_keydup(struct dict *d, char *key)
+{
+	int len = strlen(key) + 1;
+	char *dup;
+	if (!d->blk_n || d->blk_used + len > ARENASZ) {
+		if (!(d->blk_n & (d->blk_n - 1)))
+			d->blk = mextend(d->blk, d->blk_n,
+				d->blk_n ? d->blk_n * 2 : 1, sizeof(d->blk[0]));
+		d->blk[d->blk_n++] = xmalloc(len > ARENASZ ? len : ARENASZ);
+		d->blk_used = 0;
+	}
+	dup = d->blk[d->blk_n - 1] + d->blk_used;
+	memcpy(dup, key, len);
+	d->blk_used += len > ARENASZ ? ARENASZ : len;
+	return dup;
 }
 
 void dict_put(struct dict *d, char *key, int val)
 {
-	int idx;
+	unsigned h = dict_hash(key);
+	int idx, pos;
 	if (d->n >= d->size)
-		dict_extend(d, d->n + CNTMIN);
-	if (d->dupkeys) {
-		int len = strlen(key) + 1;
-		char *dup = xmalloc(len);
-		memcpy(dup, key, len);
-		key = dup;
-	}
+		dict_extend(d, d->size * 2);
+	if ((d->used + 1) * 2 > d->slots)
+		dict_rehash(d, d->slots * 2);
+	if (d->dupkeys)
+		key = dict_keydup(d, key);
 	idx = d->n++;
 	d->key[idx] = key;
 	d->val[idx] = val;
-	iset_put(d->map, dict_hash(d, key), idx);
+	d->hash[idx] = h;
+	pos = dict_slot(d, key, h);
+	if (!d->tab[pos])
+		d->used++;
+	d->tab[pos] = idx;
 }
 
 /* return the index of key in d */
 int dict_idx(struct dict *d, char *key)
 {
-	int h = dict_hash(d, key);
-	int *b = iset_get(d->map, h);
-	int *r = b + iset_len(d->map, h);
-	while (b && --r >= b)
-		if (!strcmp(d->key[*r], key))
-			return *r;
-	return -1;
+	int i = d->tab[dict_slot(d, key, dict_hash(key))];
+	return i ? i : -1;
 }
 
 char *dict_key(struct dict *d, int idx)
@@ -108,16 +167,3 @@ int dict_get(struct dict *d, char *key)
 	int idx = dict_idx(d, key);
 	return idx >= 0 ? d->val[idx] : d->notfound;
 }
-
-/* match a prefix of key; in the first call, *pos should be -1 */
-int dict_prefix(struct dict *d, char *key, int *pos)
-{
-	int *r = iset_get(d->map, dict_hash(d, key));
-	while (r && r[++*pos] >= 0) {
-		int idx = r[*pos];
-		int plen = strlen(d->key[idx]);
-		if (!strncmp(d->key[idx], key, plen))
-			return d->val[idx];
-	}
-	return d->notfound;
-}
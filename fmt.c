@@ -46,10 +46,12 @@ struct fmt {
 	/* queued lines */
 	struct line *lines;
 	int lines_head, lines_tail, lines_sz;
-	/* for paragraph adjustment */
+	/* for paragraph adjustment; kept while words are appended */
 	long *best;
 	int *best_pos;
 	int *best_dep;
+	int best_n, best_sz;	/* best breaks are known up to best_n */
+	int best_conf[6];	/* fmt_costconf() for the known breaks */
 	/* current line */
 	int gap;		/* space before the next word */
 	int nls;		/* newlines before the next word */
@@ -224,6 +226,7 @@ static int fmt_sp(struct fmt *f)
 	f->nls--;
 	f->nls_sup = 0;
 	f->words_n = 0;
+	f->best_n = 0;
 	f->fillreq = 0;
 	return 0;
 }
@@ -479,8 +482,14 @@ static long hycost(int depth)
 	return depth ? n_hycost : 0;
 }
 
-/* the cost of putting a line break before word pos */
-static long fmt_findcost(struct fmt *f, int pos)
+/* the cost of the best formatting of the words before pos */
+static long fmt_prevcost(struct fmt *f, int pos)
+{
+	return pos > 0 ? f->best[pos] + f->words[pos - 1].cost : 0;
+}
+
+/* find the best line ending before word pos; words before it are done */
+static void fmt_bestline(struct fmt *f, int pos)
 {
 	int i, hyphenated;
 	long cur;
@@ -489,12 +498,9 @@ static long fmt_findcost(struct fmt *f, int pos)
 	int swid = 0;		/* amount of stretchable spaces */
 	int nspc = 0;		/* number of stretchable spaces */
 	int dwid = 0;		/* equal to swid, unless swid is zero */
-	if (pos <= 0)
-		return 0;
-	if (f->best_pos[pos] >= 0)
-		return f->best[pos] + f->words[pos - 1].cost;
 	lwid = f->words[pos - 1].hy;	/* non-zero if the last word is hyphenated */
 	hyphenated = f->words[pos - 1].hy != 0;
+	f->best_pos[pos] = -1;
 	i = pos - 1;
 	while (i >= 0) {
 		lwid += f->words[i].wid;
@@ -509,7 +515,7 @@ static long fmt_findcost(struct fmt *f, int pos)
 		dwid = swid;
 		if (!dwid && i > 0)	/* no stretchable spaces */
 			dwid = f->words[i - 1].swid;
-		cur = fmt_findcost(f, i) + FMT_COST(llen, lwid, dwid, nspc);
+		cur = fmt_prevcost(f, i) + FMT_COST(llen, lwid, dwid, nspc);
 		if (hyphenated)
 			cur += hycost(1 + fmt_hydepth(f, i));
 		if (f->best_pos[pos] < 0 || cur < f->best[pos]) {
@@ -519,7 +525,49 @@ static long fmt_findcost(struct fmt *f, int pos)
 		}
 		i--;
 	}
-	return f->best[pos] + f->words[pos - 1].cost;
+}
+
+/* the cost of putting a line break before word pos */
+static long fmt_findcost(struct fmt *f, int pos)
+{
+	/* lines ending before earlier words are found first */
+	while (f->best_n < pos)
+		fmt_bestline(f, ++f->best_n);
+	return fmt_prevcost(f, pos);
+}
+
+/* the values the costs of line breaks depend on, other than words */
+static void fmt_costconf(struct fmt *f, int *conf)
+{
+	conf[0] = FMT_LLEN(f);
+	conf[1] = n_ssh;
+	conf[2] = n_hlm;
+	conf[3] = n_hycost;
+	conf[4] = n_hycost2;
+	conf[5] = n_hycost3;
+}
+
+/* prepare best[] for the queued words, keeping the breaks still valid */
+static void fmt_bestinit(struct fmt *f)
+{
+	int conf[6];
+	if (f->words_n + 1 > f->best_sz) {
+		int sz = MAX(f->words_n + 1, f->best_sz * 2);
+		f->best = mextend(f->best, f->best_sz, sz, sizeof(f->best[0]));
+		f->best_pos = mextend(f->best_pos, f->best_sz, sz,
+			sizeof(f->best_pos[0]));
+		f->best_dep = mextend(f->best_dep, f->best_sz, sz,
+			sizeof(f->best_dep[0]));
+		f->best_sz = sz;
+	}
+	fmt_costconf(f, conf);
+	if (memcmp(conf, f->best_conf, sizeof(conf))) {
+		memcpy(f->best_conf, conf, sizeof(conf));
+		f->best_n = 0;
+	}
+	f->best[0] = 0;
+	f->best_pos[0] = -1;
+	f->best_dep[0] = 0;
 }
 
 static int fmt_bestpos(struct fmt *f, int pos)
@@ -615,16 +663,23 @@ static int fmt_head(struct fmt *f, int nreq, int pos, int nohy)
 /* break f->words[0..end] into lines according to fmt_bestpos() */
 static int fmt_break(struct fmt *f, int end)
 {
-	int beg, ret = 0;
-	beg = fmt_bestpos(f, end);
-	if (beg > 0)
-		ret += fmt_break(f, beg);
-	f->words[beg].gap = 0;
-	if (fmt_extractline(f, beg, end, 1))
-		return ret;
-	if (beg > 0)
-		fmt_confupdate(f);
-	return ret + (end - beg);
+	int n = fmt_bestdep(f, end);
+	int *begs = xmalloc((n + 1) * sizeof(begs[0]));
+	int ret = 0;
+	int i;
+	begs[n] = end;
+	for (i = n - 1; i >= 0; i--)
+		begs[i] = fmt_bestpos(f, begs[i + 1]);
+	for (i = 0; i < n; i++) {
+		f->words[begs[i]].gap = 0;
+		if (fmt_extractline(f, begs[i], begs[i + 1], 1))
+			break;
+		if (begs[i] > 0)
+			fmt_confupdate(f);
+		ret += begs[i + 1] - begs[i];
+	}
+	free(begs);
+	return ret;
 }
 
 /* estimated number of lines until traps or the end of a page */
@@ -642,7 +697,7 @@ static int fmt_fillwords(struct fmt *f, int br)
 	int end_head;	/* like end, but only the first nreq lines included */
 	int head = 0;	/* only nreq first lines have been formatted */
 	int llen;	/* line length, taking shrinkable spaces into account */
-	int n, i;
+	int n;
 	if (!FMT_FILL(f))
 		return 0;
 	llen = fmt_wordslen(f, 0, f->words_n) -
@@ -658,14 +713,7 @@ static int fmt_fillwords(struct fmt *f, int br)
 	/* enough lines are collected already */
 	if (nreq > 0 && nreq <= fmt_nlines(f))
 		return 1;
-	/* resetting positions */
-	f->best = malloc((f->words_n + 1) * sizeof(f->best[0]));
-	f->best_pos = malloc((f->words_n + 1) * sizeof(f->best_pos[0]));
-	f->best_dep = malloc((f->words_n + 1) * sizeof(f->best_dep[0]));
-	memset(f->best, 0, (f->words_n + 1) * sizeof(f->best[0]));
-	memset(f->best_dep, 0, (f->words_n + 1) * sizeof(f->best_dep[0]));
-	for (i = 0; i < f->words_n + 1; i++)
-		f->best_pos[i] = -1;
+	fmt_bestinit(f);
 	end = fmt_breakparagraph(f, f->words_n, br);
 	if (nreq > 0) {
 		int nohy = 0;	/* do not hyphenate the last line */
@@ -675,8 +723,11 @@ static int fmt_fillwords(struct fmt *f, int br)
 		head = end_head < end;
 		end = end_head;
 	}
-	/* recursively add lines */
+	/* add lines */
 	n = end > 0 ? fmt_break(f, end) : 0;
+	/* best[] is relative to the first queued word */
+	if (n)
+		f->best_n = 0;
 	f->words_n -= n;
 	f->fillreq -= n;
 	fmt_movewords(f, 0, n, f->words_n);
@@ -685,12 +736,6 @@ static int fmt_fillwords(struct fmt *f, int br)
 		f->words[0].gap = 0;
 	if (f->words_n)		/* apply the new .l and .i */
 		fmt_confupdate(f);
-	free(f->best);
-	free(f->best_pos);
-	free(f->best_dep);
-	f->best = NULL;
-	f->best_pos = NULL;
-	f->best_dep = NULL;
 	return head || n != end;
 }
 
@@ -705,6 +750,9 @@ void fmt_free(struct fmt *fmt)
 {
 	free(fmt->lines);
 	free(fmt->words);
+	free(fmt->best);
+	free(fmt->best_pos);
+	free(fmt->best_dep);
 	free(fmt);
 }
 
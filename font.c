@@ -1,9 +1,20 @@
 /* font handling */
+#include <fcntl.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "roff.h"
 
+#define LCSIZE		4096	/* number of font_layout() cache slots per font */
+#define NPLANS		8	/* number of rule plans per font */
+#define NSIZES		8	/* number of scaled metric tables per font */
+#define NIDLE		32	/* number of unused fonts kept in the registry */
+#define NFEATW		((NFEATS + 31) / 32)	/* words in feature bitsets */
+
 /* convert wid in device unitwidth size to size sz */
 #define DEVWID(sz, wid)		(((wid) * (sz) + (dev_uwid / 2)) / dev_uwid)
 
@@ -15,16 +26,108 @@
 
 /* glyph substitution and positioning rules */
 struct grule {
-	struct gpat {			/* rule description */
-		int g;			/* glyph index */
-		short flg;		/* pattern flags; GF_* */
-		short x, y, xadv, yadv;	/* gpos data */
-	} *pats;			/* rule pattern */
+	int pats;			/* rule pattern; index into pats[] */
 	int sec;			/* rule section (OFF lookup) */
-	short len;			/* pats[] length */
+	short len;			/* pattern length */
 	short feat, scrp, lang;		/* rule's feature and script */
 };
 
+struct gpat {				/* rule description */
+	int g;				/* glyph index */
+	short flg;			/* pattern flags; GF_* */
+	short x, y, xadv, yadv;		/* gpos data */
+};
+
+/*
+ * Compiled fonts
+ *
+ * After reading a font description, font_open() compiles it into a
+ * single memory block, a font image, which contains glyph metrics,
+ * hash tables for looking up glyphs by their names and identifiers,
+ * glyph substitution and positioning rules, glyph groups, and a hash
+ * table of kerning pairs.  The image contains no pointers and can be
+ * saved in the directory specified with font_cache() and mapped
+ * directly in later runs.  The active rules for each combination of
+ * enabled features, script, and language are indexed by their first
+ * glyph when first needed (font_plan()).
+ */
+#define FI_MAGIC	"neatfc5"
+
+struct fimg {
+	char magic[8];			/* FI_MAGIC */
+	int hdrsz;			/* sizeof(struct fimg) */
+	long size;			/* image size */
+	long src_mtime, src_size;	/* source font modification time and size */
+	char src[PATHLEN];		/* source font path */
+	char name[FNLEN];
+	char fontname[FNLEN];
+	int spacewid;
+	int special;
+	char feat_name[NFEATS][8];	/* feature names */
+	char scrp_name[NSCRPS][8];	/* script names */
+	char lang_name[NLANGS][8];	/* language names */
+	int gl_n;			/* number of glyphs */
+	int gsub_n, gpos_n;		/* number of gsub and gpos rules */
+	int kern_n;			/* number of kerning pairs */
+	int str_n;			/* string pool size */
+	int pats_n;			/* number of rule patterns */
+	/* the offset of image sections */
+	int gl;				/* glyphs (struct fglyph) */
+	int str;			/* string pool */
+	int gl_tab;			/* hash table of glyph identifiers */
+	int ch_tab;			/* hash table of glyph names */
+	int al_tab;			/* hash table of charset aliases */
+	int gsub, gpos;			/* rules (struct grule) */
+	int pats;			/* rule patterns (struct gpat) */
+	int ggrp;			/* glyphs of each group */
+	int ggrp_bits;			/* glyphs of each group as bitsets */
+	int kern;			/* kerning pairs */
+};
+
+/* active rules for a combination of features, script, and language */
+struct fplan {
+	unsigned feat[NFEATW];		/* enabled features */
+	int scrp, lang;			/* script and language */
+	struct iset *gsub0;		/* active gsub rules by their first glyph */
+	struct iset *gpos0;		/* active gpos rules by their first glyph */
+};
+
+/* glyph metrics scaled for a font size */
+struct fsize {
+	int sz;				/* font size; -1 if unused */
+	int twid;			/* track kerning width */
+	int ss[2], swid[2];		/* space width for two values of ss */
+	int *wid;			/* glyph widths */
+	int *box;			/* glyph bounding boxes */
+	char *set;			/* glyph metrics computed */
+};
+
+/* cached font_layout() results */
+struct lcache {
+	int *key;			/* layout state and source glyphs */
+	int klen;			/* key length */
+	int n;				/* number of result glyphs */
+	int *dat;			/* dst, dmap, x, y, xadv, and yadv */
+};
+
+struct fglyph {
+	int id, name;			/* offsets in the string pool */
+	short wid;
+	short llx, lly, urx, ury;
+	short type;
+};
+
+/* a font in the registry; shared by the mounts of a font file */
+struct fdata {
+	struct fimg *img;		/* font image */
+	int img_mapped;			/* img is mapped via mmap() */
+	struct glyph *gl;		/* glyphs, copied for each mount */
+	int ref;			/* the number of mounts */
+	int stale;			/* the font file has been modified */
+	struct fdata *next;
+};
+
+/* a mounted font */
 struct font {
 	char name[FNLEN];
 	char fontname[FNLEN];
@@ -33,9 +136,7 @@ struct font {
 	int cs, cs_ps, bd, zoom;	/* for .cs, .bd, .fzoom requests */
 	int s1, n1, s2, n2;		/* for .tkf request */
 	struct glyph *gl;		/* glyphs present in the font */
-	int gl_n, gl_sz;		/* number of glyphs in the font */
-	struct dict *gl_dict;		/* mapping from gl[i].id to i */
-	struct dict *ch_dict;		/* charset mapping */
+	int gl_n;			/* number of glyphs in the font */
 	struct dict *ch_map;		/* characters mapped via font_map() */
 	/* font features and scripts */
 	char feat_name[NFEATS][8];	/* feature names */
@@ -44,49 +145,84 @@ struct font {
 	int scrp;			/* current script */
 	char lang_name[NLANGS][8];	/* language names */
 	int lang;			/* current language */
-	int secs;			/* number of font sections (OFF lookups) */
-	/* glyph substitution and positioning */
+	/* the compiled font */
+	struct fdata *fd;		/* registry entry */
+	char *str;			/* string pool */
+	int *gl_tab, *ch_tab, *al_tab;	/* hash tables */
 	struct grule *gsub;		/* glyph substitution rules */
-	int gsub_n, gsub_sz;
+	int gsub_n;
 	struct grule *gpos;		/* glyph positioning rules */
-	int gpos_n, gpos_sz;
-	struct iset *gsub0;		/* rules matching a glyph at pos 0 */
-	struct iset *gpos0;		/* rules matching a glyph at pos 0 */
-	struct iset *ggrp;		/* sets of glyphs for each group */
-	struct iset *ggrp_rev;		/* sets of groups for each glyph */
+	int gpos_n;
+	int *kern;			/* kerning pair hash table or NULL */
+	int kern_feat;			/* the index of kern feature */
+	struct gpat *pats;		/* rule patterns */
+	struct fplan plans[NPLANS];	/* rule plans */
+	int plans_n;			/* number of plans in plans[] */
+	int plans_cur;			/* the next plan to replace */
+	struct fplan *plan;		/* the plan for the current state or NULL */
+	struct lcache *lc;		/* font_layout() cache */
+	struct fsize sizes[NSIZES];	/* scaled metrics */
+	int sizes_cur;			/* the next size to replace */
+	int *ggrp;			/* sets of glyphs for each group */
+	int *ggrp_bits;			/* glyphs of each group as bitsets */
 };
 
+static char font_cdir[PATHLEN];	/* compiled font directory */
+static struct fdata *font_reg;	/* font registry */
+static int font_lchits, font_lcmisses;	/* font_layout() cache statistics */
+
+static unsigned long font_hash(char *s)
+{
+	unsigned long hash = 5381;
+	while (*s)
+		hash = (hash << 5) + hash + (unsigned char) *s++;
+	return hash;
+}
+
+/* look up key in an image hash table; tab[0] is the number of slots */
+static int font_hget(struct font *fn, int *tab, char *key)
+{
+	int mask = tab[0] - 1;
+	int i = font_hash(key) & mask;
+	while (tab[1 + i * 2]) {
+		if (!strcmp(fn->str + tab[1 + i * 2], key))
+			return tab[2 + i * 2];
+		i = (i + 1) & mask;
+	}
+	return -1;
+}
+
+/* the members of an image set; a list terminated with -1 */
+static int *font_set(int *set, int key)
+{
+	return key >= 0 && key < set[0] ? set + set[1 + key] : NULL;
+}
+
+/* look up a character mapped via font_map() or charset aliases */
+static int font_chmap(struct font *fn, char *name)
+{
+	int i = dict_idx(fn->ch_map, name);
+	return i >= 0 ? dict_val(fn->ch_map, i) : font_hget(fn, fn->al_tab, name);
+}
+
 /* find a glyph by its name */
 struct glyph *font_find(struct font *fn, char *name)
 {
-	int i = dict_get(fn->ch_map, name);
+	int i = font_chmap(fn, name);
 	if (i == -1)		/* -2 means the glyph has been unmapped */
-		i = dict_get(fn->ch_dict, name);
+		i = font_hget(fn, fn->ch_tab, name);
 	return i >= 0 ? fn->gl + i : NULL;
 }
 
 /* find a glyph by its device-dependent identifier */
 struct glyph *font_glyph(struct font *fn, char *id)
 {
-	int i = dict_get(fn->gl_dict, id);
+	int i = font_hget(fn, fn->gl_tab, id);
 	return i >= 0 ? &fn->gl[i] : NULL;
 }
 
-static int font_glyphput(struct font *fn, char *id, char *name, int type)
-{
-	struct glyph *g;
-	if (fn->gl_n == fn->gl_sz) {
-		fn->gl_sz = fn->gl_sz + 1024;
-		fn->gl = mextend(fn->gl, fn->gl_n, fn->gl_sz, sizeof(fn->gl[0]));
-	}
-	g = &fn->gl[fn->gl_n];
-	snprintf(g->id, sizeof(g->id), "%s", id);
-	snprintf(g->name, sizeof(g->name), "%s", name);
-	g->type = type;
-	g->font = fn;
-	dict_put(fn->gl_dict, g->id, fn->gl_n);
-	return fn->gl_n++;
-}
+static void font_lcclear(struct font *fn);
+static void font_szclear(struct font *fn);
 
 /* map character name to the given glyph; remove the mapping if id is NULL */
 int font_map(struct font *fn, char *name, char *id)
@@ -95,30 +231,42 @@ int font_map(struct font *fn, char *name, char *id)
 	if (id)
 		gidx = font_glyph(fn, id) ? font_glyph(fn, id) - fn->gl : -2;
 	dict_put(fn->ch_map, name, gidx);
+	font_lcclear(fn);
 	return 0;
 }
 
 /* return nonzero if character name has been mapped with font_map() */
 int font_mapped(struct font *fn, char *name)
 {
-	return dict_get(fn->ch_map, name) != -1;
+	return font_chmap(fn, name) != -1;
 }
 
 static int font_findfeat(struct font *fn, char *feat);
 
+static int font_featset(struct font *fn, char *name, int val)
+{
+	int idx = font_findfeat(fn, name);
+	int old = idx >= 0 ? fn->feat_set[idx] : 0;
+	if (idx >= 0 && fn->feat_set[idx] != (val != 0)) {
+		fn->feat_set[idx] = val != 0;
+		fn->plan = NULL;
+	}
+	return old;
+}
+
 /* enable/disable ligatures; first bit for liga and the second bit for rlig */
 static int font_featlg(struct font *fn, int val)
 {
 	int ret = 0;
-	ret |= font_feat(fn, "liga", val & 1);
-	ret |= font_feat(fn, "rlig", val & 2) << 1;
+	ret |= font_featset(fn, "liga", val & 1);
+	ret |= font_featset(fn, "rlig", val & 2) << 1;
 	return ret;
 }
 
 /* enable/disable pairwise kerning */
 static int font_featkn(struct font *fn, int val)
 {
-	return font_feat(fn, "kern", val);
+	return font_featset(fn, "kern", val);
 }
 
 /* glyph index in fn->glyphs[] */
@@ -127,11 +275,26 @@ static int font_idx(struct font *fn, struct glyph *g)
 	return g ? g - fn->gl : -1;
 }
 
+/* check if glyph g is in group grp */
+static int font_ggrphas(struct font *fn, int grp, int g)
+{
+	int *tab = fn->ggrp_bits;
+	int *ent;			/* first glyph, last glyph + 1, bitset */
+	unsigned *bits;
+	if (grp < 0 || grp >= tab[0])
+		return 0;
+	ent = tab + 1 + grp * 3;
+	if (g < ent[0] || g >= ent[1])
+		return 0;
+	bits = (unsigned *) tab + ent[2];
+	return (bits[(g - ent[0]) / 32] >> ((g - ent[0]) % 32)) & 1;
+}
+
 static int font_gpatmatch(struct font *fn, struct gpat *p, int g)
 {
 	if (!(p->flg & GF_GRP))
 		return p->g == g;
-	return iset_has(fn->ggrp_rev, g, p->g);
+	return font_ggrphas(fn, p->g, g);
 }
 
 static int font_rulematch(struct font *fn, struct grule *rule,
@@ -139,16 +302,8 @@ static int font_rulematch(struct font *fn, struct grule *rule,
 {
 	int sidx = 0;		/* the index of matched glyphs in src */
 	int ncon = 0;		/* number of initial context glyphs */
-	struct gpat *pats = rule->pats;
+	struct gpat *pats = fn->pats + rule->pats;
 	int j;
-	/* enable only the active script if set */
-	if (fn->scrp >= 0 && fn->scrp != rule->scrp)
-		return 0;
-	/* enable common script features and those in the active language */
-	if (rule->lang >= 0 && fn->lang != rule->lang)
-		return 0;
-	if (!fn->feat_set[rule->feat])
-		return 0;
 	/* the number of initial context glyphs */
 	for (j = 0; j < rule->len && pats[j].flg & GF_CON; j++)
 		ncon++;
@@ -169,20 +324,124 @@ static int font_rulematch(struct font *fn, struct grule *rule,
 	return 1;
 }
 
-/* find a matching gsub/gpos rule; *idx should be -1 initially */
-static int font_findrule(struct font *fn, int gsub, int pos,
+/* find a matching active gpos rule; *idx should be -1 initially */
+static int font_findrule(struct font *fn,
 		int *fwd, int fwdlen, int *ctx, int ctxlen, int *idx)
 {
-	struct grule *rules = gsub ? fn->gsub : fn->gpos;
-	int *r1 = iset_get(gsub ? fn->gsub0 : fn->gpos0, fwd[0]);
+	int *r1 = iset_get(fn->plan->gpos0, fwd[0]);
 	while (r1 && r1[++*idx] >= 0) {
-		if (r1[*idx] >= pos && font_rulematch(fn, &rules[r1[*idx]],
+		if (font_rulematch(fn, &fn->gpos[r1[*idx]],
 						fwd, fwdlen, ctx, ctxlen))
 			return r1[*idx];
 	}
 	return -1;
 }
 
+static struct gpat *font_rulefirstpat(struct font *fn, struct grule *rule)
+{
+	struct gpat *pats = fn->pats + rule->pats;
+	int i;
+	for (i = 0; i < rule->len; i++)
+		if (!(pats[i].flg & (GF_REP | GF_CON)))
+			return &pats[i];
+	return NULL;
+}
+
+static void font_isetinsert(struct font *fn, struct iset *iset, int rule, struct gpat *p)
+{
+	if (p->flg & GF_GRP) {
+		int *r = font_set(fn->ggrp, p->g);
+		while (r && *r >= 0)
+			iset_put(iset, *r++, rule);
+	} else {
+		if (p->g >= 0)
+			iset_put(iset, p->g, rule);
+	}
+}
+
+/* check if rule is enabled in the current state of the font */
+static int font_ruleon(struct font *fn, struct grule *rule)
+{
+	/* enable only the active script if set */
+	if (fn->scrp >= 0 && fn->scrp != rule->scrp)
+		return 0;
+	/* enable common script features and those in the active language */
+	if (rule->lang >= 0 && fn->lang != rule->lang)
+		return 0;
+	return rule->feat >= 0 && fn->feat_set[rule->feat];
+}
+
+static struct iset *font_rulesidx(struct font *fn, struct grule *rules, int n)
+{
+	struct iset *iset = iset_make();
+	int i;
+	for (i = 0; i < n; i++)
+		if (font_ruleon(fn, &rules[i]))
+			font_isetinsert(fn, iset, i,
+				font_rulefirstpat(fn, &rules[i]));
+	iset_freeze(iset);
+	return iset;
+}
+
+static void font_featbits(struct font *fn, unsigned *feat)
+{
+	int i;
+	memset(feat, 0, NFEATW * sizeof(feat[0]));
+	for (i = 0; i < NFEATS; i++)
+		if (fn->feat_set[i])
+			feat[i / 32] |= 1u << (i % 32);
+}
+
+/* find or build the rule plan for the current state of the font */
+static struct fplan *font_plan(struct font *fn)
+{
+	unsigned feat[NFEATW];
+	struct fplan *p;
+	int i;
+	if (fn->plan)
+		return fn->plan;
+	font_featbits(fn, feat);
+	for (i = 0; i < fn->plans_n; i++) {
+		p = &fn->plans[i];
+		if (p->scrp == fn->scrp && p->lang == fn->lang &&
+				!memcmp(p->feat, feat, sizeof(feat)))
+			return fn->plan = p;
+	}
+	if (fn->plans_n < NPLANS) {
+		p = &fn->plans[fn->plans_n++];
+	} else {
+		p = &fn->plans[fn->plans_cur];
+		fn->plans_cur = (fn->plans_cur + 1) % NPLANS;
+		iset_free(p->gsub0);
+		iset_free(p->gpos0);
+	}
+	memcpy(p->feat, feat, sizeof(feat));
+	p->scrp = fn->scrp;
+	p->lang = fn->lang;
+	p->gsub0 = font_rulesidx(fn, fn->gsub, fn->gsub_n);
+	p->gpos0 = font_rulesidx(fn, fn->gpos, fn->gpos_n);
+	return fn->plan = p;
+}
+
+static unsigned font_kernhash(int g1, int g2)
+{
+	return (unsigned) g1 * 31321 + (unsigned) g2 * 7;
+}
+
+/* kerning between glyphs g1 and g2 */
+static int font_kern(struct font *fn, int g1, int g2)
+{
+	int *tab = fn->kern;
+	int mask = tab[0] - 1;
+	int i = font_kernhash(g1, g2) & mask;
+	while (tab[1 + i * 3] >= 0) {
+		if (tab[1 + i * 3] == g1 && tab[2 + i * 3] == g2)
+			return tab[3 + i * 3];
+		i = (i + 1) & mask;
+	}
+	return 0;
+}
+
 /* perform all possible gpos rules on src */
 static void font_performgpos(struct font *fn, int *src, int slen,
 		int *x, int *y, int *xadv, int *yadv)
@@ -193,19 +452,25 @@ static void font_performgpos(struct font *fn, int *src, int slen,
 	int curs_beg = -1;
 	int curs_dif = 0;
 	int i, k;
+	/* kerning pairs have no script or language */
+	int kern = fn->kern && fn->scrp < 0 && fn->feat_set[fn->kern_feat];
+	font_plan(fn);
 	for (i = 0; i < slen; i++) {
 		int idx = -1;
 		int curs_cur = 0;
 		int lastsec = -1;
+		/* kerning pairs belong to no lookup and come first */
+		if (kern && i + 1 < slen)
+			xadv[i] += font_kern(fn, src[i], src[i + 1]);
 		while (1) {
-			int r = font_findrule(fn, 0, 0, src + i, slen - i,
+			int r = font_findrule(fn, src + i, slen - i,
 						src + i, i, &idx);
 			if (r < 0)		/* no rule found */
 				break;
 			if (gpos[r].sec > 0 && gpos[r].sec <= lastsec)
 				continue;	/* perform at most one rule from each lookup */
 			lastsec = gpos[r].sec;
-			pats = gpos[r].pats;
+			pats = fn->pats + gpos[r].pats;
 			for (k = 0; k < gpos[r].len; k++) {
 				x[i + k] += pats[k].x;
 				y[i + k] += pats[k].y;
@@ -230,17 +495,23 @@ static void font_performgpos(struct font *fn, int *src, int slen,
 		yadv[curs_beg] -= curs_dif;
 }
 
-/* find the first gsub rule after pos that matches any glyph in src */
-static int font_firstgsub(struct font *fn, int pos, int *src, int slen)
+/* the first active gsub rule after cur that may match a glyph in src */
+static int font_nextgsub(struct font *fn, int cur, int *src, int slen)
 {
 	int best = -1;
 	int i;
 	for (i = 0; i < slen; i++) {
-		int idx = -1;
-		int r = font_findrule(fn, 1, pos, src + i, slen - i,
-					src + i, i, &idx);
-		if (r >= 0 && (best < 0 || r < best))
-			best = r;
+		int *r = iset_get(fn->plan->gsub0, src[i]);
+		int l = 0, h = iset_len(fn->plan->gsub0, src[i]);
+		while (l < h) {		/* r[] is sorted */
+			int m = (l + h) / 2;
+			if (r[m] <= cur)
+				l = m + 1;
+			else
+				h = m;
+		}
+		if (r && r[l] >= 0 && (best < 0 || r[l] < best))
+			best = r[l];
 	}
 	return best;
 }
@@ -249,6 +520,7 @@ static int font_firstgsub(struct font *fn, int pos, int *src, int slen)
 static int font_gsubapply(struct font *fn, struct grule *rule,
 			int *src, int slen, int *smap)
 {
+	struct gpat *pats = fn->pats + rule->pats;
 	int dst[WORDLEN];
 	int dlen = 0;
 	int dmap[WORDLEN];
@@ -259,9 +531,9 @@ static int font_gsubapply(struct font *fn, struct grule *rule,
 		if (font_rulematch(fn, rule, src + i, slen - i,
 					dst + dlen, dlen)) {
 			for (j = 0; j < rule->len; j++) {
-				if (rule->pats[j].flg & GF_REP)
-					dst[dlen++] = rule->pats[j].g;
-				if (rule->pats[j].flg & GF_PAT)
+				if (pats[j].flg & GF_REP)
+					dst[dlen++] = pats[j].g;
+				if (pats[j].flg & GF_PAT)
 					i++;
 			}
 			i--;
@@ -274,29 +546,96 @@ static int font_gsubapply(struct font *fn, struct grule *rule,
 	return dlen;
 }
 
-/* perform all possible gsub rules on src */
+/*
+ * perform all possible gsub rules on src
+ *
+ * The rules are applied in order, each in a single pass over src.
+ * Only the rules indexed under a glyph present in src are tried;
+ * applying a rule that matches nowhere leaves src unchanged.
+ */
 static int font_performgsub(struct font *fn, int *src, int slen, int *smap)
 {
 	int i = -1;
-	while (++i >= 0) {
-		if ((i = font_firstgsub(fn, i, src, slen)) < 0)
-			break;
+	font_plan(fn);
+	while ((i = font_nextgsub(fn, i, src, slen)) >= 0)
 		slen = font_gsubapply(fn, &fn->gsub[i], src, slen, smap);
-	}
 	return slen;
 }
 
+/* the key of font_layout() cache: layout state followed by glyphs */
+static int font_lckey(struct font *fn, int *key, int *src, int n, int lg, int kn)
+{
+	int klen = 0;
+	key[klen++] = n;
+	key[klen++] = (lg != 0) | (kn != 0) << 1 | (dir_do != 0) << 2;
+	key[klen++] = fn->scrp;
+	key[klen++] = fn->lang;
+	font_featbits(fn, (unsigned *) key + klen);
+	klen += NFEATW;
+	memcpy(key + klen, src, n * sizeof(src[0]));
+	return klen + n;
+}
+
+static struct lcache *font_lcslot(struct font *fn, int *key, int klen)
+{
+	unsigned long hash = 5381;
+	int i;
+	if (!fn->lc) {
+		fn->lc = xmalloc(LCSIZE * sizeof(fn->lc[0]));
+		memset(fn->lc, 0, LCSIZE * sizeof(fn->lc[0]));
+	}
+	for (i = 0; i < klen; i++)
+		hash = (hash << 5) + hash + key[i];
+	return &fn->lc[hash & (LCSIZE - 1)];
+}
+
+static void font_lcclear(struct font *fn)
+{
+	int i;
+	if (!fn->lc)
+		return;
+	for (i = 0; i < LCSIZE; i++)
+		free(fn->lc[i].key);
+	free(fn->lc);
+	fn->lc = NULL;
+}
+
+/* return font_layout() cache hits and misses */
+void font_lcstat(int *hits, int *misses)
+{
+	*hits = font_lchits;
+	*misses = font_lcmisses;
+}
+
 int font_layout(struct font *fn, struct glyph **gsrc, int nsrc, int sz,
 		struct glyph **gdst, int *dmap,
 		int *x, int *y, int *xadv, int *yadv, int lg, int kn)
 {
 	int dst[WORDLEN];
+	int key[WORDLEN + 4 + NFEATW];
+	struct lcache *lc;
 	int ndst = nsrc;
-	int i;
-	int featlg, featkn;
+	int i, klen;
+	int featlg = 0, featkn = 0;
 	/* initialising dst */
 	for (i = 0; i < nsrc; i++)
 		dst[i] = font_idx(fn, gsrc[i]);
+	/* looking up the cache */
+	klen = font_lckey(fn, key, dst, nsrc, lg, kn);
+	lc = font_lcslot(fn, key, klen);
+	if (lc->key && lc->klen == klen && !memcmp(lc->key, key, klen * sizeof(key[0]))) {
+		ndst = lc->n;
+		memcpy(dmap, lc->dat + ndst, ndst * sizeof(dmap[0]));
+		memcpy(x, lc->dat + ndst * 2, ndst * sizeof(x[0]));
+		memcpy(y, lc->dat + ndst * 3, ndst * sizeof(y[0]));
+		memcpy(xadv, lc->dat + ndst * 4, ndst * sizeof(xadv[0]));
+		memcpy(yadv, lc->dat + ndst * 5, ndst * sizeof(yadv[0]));
+		for (i = 0; i < ndst; i++)
+			gdst[i] = fn->gl + lc->dat[i];
+		font_lchits++;
+		return ndst;
+	}
+	font_lcmisses++;
 	for (i = 0; i < ndst; i++)
 		dmap[i] = i;
 	memset(x, 0, ndst * sizeof(x[0]));
@@ -317,12 +656,143 @@ int font_layout(struct font *fn, struct glyph **gsrc, int nsrc, int sz,
 		font_featkn(fn, featkn);
 	for (i = 0; i < ndst; i++)
 		gdst[i] = fn->gl + dst[i];
+	/* saving the result */
+	free(lc->key);
+	lc->key = xmalloc((klen + ndst * 6) * sizeof(lc->key[0]));
+	lc->klen = klen;
+	lc->n = ndst;
+	lc->dat = lc->key + klen;
+	memcpy(lc->key, key, klen * sizeof(key[0]));
+	memcpy(lc->dat, dst, ndst * sizeof(dst[0]));
+	memcpy(lc->dat + ndst, dmap, ndst * sizeof(dmap[0]));
+	memcpy(lc->dat + ndst * 2, x, ndst * sizeof(x[0]));
+	memcpy(lc->dat + ndst * 3, y, ndst * sizeof(y[0]));
+	memcpy(lc->dat + ndst * 4, xadv, ndst * sizeof(xadv[0]));
+	memcpy(lc->dat + ndst * 5, yadv, ndst * sizeof(yadv[0]));
 	return ndst;
 }
 
-static int font_readchar(struct font *fn, FILE *fin, int *n, int *gid)
+/* return the index of tag in tags[]; add it if missing */
+static int font_tag(char (*tags)[8], int n, char *tag)
+{
+	int i;
+	for (i = 0; i < n && tags[i][0]; i++)
+		if (!strcmp(tag, tags[i]))
+			return i;
+	if (i == n)
+		return -1;
+	snprintf(tags[i], sizeof(tags[i]), "%s", tag);
+	return i;
+}
+
+static int font_findfeat(struct font *fn, char *feat)
+{
+	return font_tag(fn->feat_name, LEN(fn->feat_name), feat);
+}
+
+static int font_findscrp(struct font *fn, char *scrp)
+{
+	return font_tag(fn->scrp_name, LEN(fn->scrp_name), scrp);
+}
+
+static int font_findlang(struct font *fn, char *lang)
+{
+	return font_tag(fn->lang_name, LEN(fn->lang_name), lang);
+}
+
+/* reading font descriptions */
+
+struct falias {
+	char name[GNLEN];		/* character name */
+	int g;				/* glyph index */
+};
+
+/* a glyph while reading a font description */
+struct fsglyph {
+	char id[GNLEN];
+	char name[GNLEN];
+	short wid;
+	short llx, lly, urx, ury;
+	short type;
+};
+
+/* a font description while being read */
+struct fsrc {
+	char name[FNLEN];
+	char fontname[FNLEN];
+	int spacewid;
+	int special;
+	struct fsglyph *gl;		/* glyphs present in the font */
+	int gl_n, gl_sz;		/* number of glyphs in the font */
+	struct dict *gl_dict;		/* mapping from gl[i].id to i */
+	struct dict *ch_dict;		/* charset mapping */
+	struct dict *ch_map;		/* charset aliases */
+	struct falias *al;		/* charset aliases in order */
+	int al_n, al_sz;
+	char feat_name[NFEATS][8];	/* feature names */
+	char scrp_name[NSCRPS][8];	/* script names */
+	char lang_name[NLANGS][8];	/* language names */
+	int secs;			/* number of font sections (OFF lookups) */
+	struct grule *gsub;		/* glyph substitution rules */
+	int gsub_n, gsub_sz;
+	struct grule *gpos;		/* glyph positioning rules */
+	int gpos_n, gpos_sz;
+	int *kern;			/* kerning pairs: glyph, glyph, value */
+	int kern_n, kern_sz;
+	struct gpat *pats;		/* rule patterns */
+	int pats_n, pats_sz;
+	struct iset *ggrp;		/* sets of glyphs for each group */
+	int ggrp_n;			/* the largest group identifier plus one */
+};
+
+static int fsrc_idx(struct fsrc *fs, struct fsglyph *g)
+{
+	return g ? g - fs->gl : -1;
+}
+
+static struct fsglyph *fsrc_glyph(struct fsrc *fs, char *id)
+{
+	int i = dict_get(fs->gl_dict, id);
+	return i >= 0 ? &fs->gl[i] : NULL;
+}
+
+static struct fsglyph *fsrc_find(struct fsrc *fs, char *name)
+{
+	int i = dict_get(fs->ch_map, name);
+	if (i == -1)
+		i = dict_get(fs->ch_dict, name);
+	return i >= 0 ? fs->gl + i : NULL;
+}
+
+static int font_glyphput(struct fsrc *fs, char *id, char *name, int type)
+{
+	struct fsglyph *g;
+	if (fs->gl_n == fs->gl_sz) {
+		fs->gl_sz = fs->gl_sz + 1024;
+		fs->gl = mextend(fs->gl, fs->gl_n, fs->gl_sz, sizeof(fs->gl[0]));
+	}
+	g = &fs->gl[fs->gl_n];
+	snprintf(g->id, sizeof(g->id), "%s", id);
+	snprintf(g->name, sizeof(g->name), "%s", name);
+	g->type = type;
+	dict_put(fs->gl_dict, g->id, fs->gl_n);
+	return fs->gl_n++;
+}
+
+static void font_aliasput(struct fsrc *fs, char *name, int g)
 {
-	struct glyph *g;
+	if (fs->al_n == fs->al_sz) {
+		fs->al_sz = fs->al_sz + 256;
+		fs->al = mextend(fs->al, fs->al_n, fs->al_sz, sizeof(fs->al[0]));
+	}
+	snprintf(fs->al[fs->al_n].name, sizeof(fs->al[0].name), "%s", name);
+	fs->al[fs->al_n++].g = g;
+	dict_put(fs->ch_map, name, g);
+}
+
+static int font_readchar(struct fsrc *fs, FILE *fin, int *n, int *gid)
+{
+	struct fsglyph *g;
 	char tok[128];
 	char name[GNLEN];
 	char id[GNLEN];
@@ -334,72 +804,39 @@ static int font_readchar(struct font *fn, FILE *fin, int *n, int *gid)
 	if (strcmp("\"", tok)) {
 		if (fscanf(fin, "%d " GNFMT, &type, id) != 2)
 			return 1;
-		*gid = font_glyphput(fn, id, name, type);
-		g = &fn->gl[*gid];
+		*gid = font_glyphput(fs, id, name, type);
+		g = &fs->gl[*gid];
 		sscanf(tok, "%hd,%hd,%hd,%hd,%hd", &g->wid,
 			&g->llx, &g->lly, &g->urx, &g->ury);
-		dict_put(fn->ch_dict, name, *gid);
+		dict_put(fs->ch_dict, name, *gid);
 		(*n)++;
 	} else {
-		dict_put(fn->ch_map, name, *gid);
+		font_aliasput(fs, name, *gid);
 	}
 	return 0;
 }
 
-static int font_findfeat(struct font *fn, char *feat)
+static int font_gpat(struct fsrc *fs, int len)
 {
-	int i;
-	for (i = 0; i < LEN(fn->feat_name) && fn->feat_name[i][0]; i++)
-		if (!strcmp(feat, fn->feat_name[i]))
-			return i;
-	if (i < LEN(fn->feat_name)) {
-		snprintf(fn->feat_name[i], sizeof(fn->feat_name[i]), "%s", feat);
-		return i;
+	if (fs->pats_n + len > fs->pats_sz) {
+		int sz = fs->pats_sz + MAX(len, 4096);
+		fs->pats = mextend(fs->pats, fs->pats_n, sz, sizeof(fs->pats[0]));
+		fs->pats_sz = sz;
 	}
-	return -1;
-}
-
-static int font_findscrp(struct font *fn, char *scrp)
-{
-	int i;
-	for (i = 0; i < LEN(fn->scrp_name) && fn->scrp_name[i][0]; i++)
-		if (!strcmp(scrp, fn->scrp_name[i]))
-			return i;
-	if (i == LEN(fn->scrp_name))
-		return -1;
-	snprintf(fn->scrp_name[i], sizeof(fn->scrp_name[i]), "%s", scrp);
-	return i;
-}
-
-static int font_findlang(struct font *fn, char *lang)
-{
-	int i;
-	for (i = 0; i < LEN(fn->lang_name) && fn->lang_name[i][0]; i++)
-		if (!strcmp(lang, fn->lang_name[i]))
-			return i;
-	if (i == LEN(fn->lang_name))
-		return -1;
-	snprintf(fn->lang_name[i], sizeof(fn->lang_name[i]), "%s", lang);
-	return i;
+	fs->pats_n += len;
+	return fs->pats_n - len;
 }
 
-static struct gpat *font_gpat(struct font *fn, int len)
-{
-	struct gpat *pats = xmalloc(len * sizeof(pats[0]));
-	memset(pats, 0, len * sizeof(pats[0]));
-	return pats;
-}
-
-static struct grule *font_gsub(struct font *fn, int len, int feat, int scrp, int lang)
+static struct grule *font_gsub(struct fsrc *fs, int len, int feat, int scrp, int lang)
 {
 	struct grule *rule;
-	struct gpat *pats = font_gpat(fn, len);
-	if (fn->gsub_n  == fn->gsub_sz) {
-		fn->gsub_sz = fn->gsub_sz + 1024;
-		fn->gsub = mextend(fn->gsub, fn->gsub_n, fn->gsub_sz,
-				sizeof(fn->gsub[0]));
+	int pats = font_gpat(fs, len);
+	if (fs->gsub_n  == fs->gsub_sz) {
+		fs->gsub_sz = fs->gsub_sz + 1024;
+		fs->gsub = mextend(fs->gsub, fs->gsub_n, fs->gsub_sz,
+				sizeof(fs->gsub[0]));
 	}
-	rule = &fn->gsub[fn->gsub_n++];
+	rule = &fs->gsub[fs->gsub_n++];
 	rule->pats = pats;
 	rule->len = len;
 	rule->feat = feat;
@@ -408,16 +845,16 @@ static struct grule *font_gsub(struct font *fn, int len, int feat, int scrp, int
 	return rule;
 }
 
-static struct grule *font_gpos(struct font *fn, int len, int feat, int scrp, int lang)
+static struct grule *font_gpos(struct fsrc *fs, int len, int feat, int scrp, int lang)
 {
 	struct grule *rule;
-	struct gpat *pats = font_gpat(fn, len);
-	if (fn->gpos_n == fn->gpos_sz) {
-		fn->gpos_sz = fn->gpos_sz + 1024;
-		fn->gpos = mextend(fn->gpos, fn->gpos_n, fn->gpos_sz,
-				sizeof(fn->gpos[0]));
+	int pats = font_gpat(fs, len);
+	if (fs->gpos_n == fs->gpos_sz) {
+		fs->gpos_sz = fs->gpos_sz + 1024;
+		fs->gpos = mextend(fs->gpos, fs->gpos_n, fs->gpos_sz,
+				sizeof(fs->gpos[0]));
 	}
-	rule = &fn->gpos[fn->gpos_n++];
+	rule = &fs->gpos[fs->gpos_n++];
 	rule->pats = pats;
 	rule->len = len;
 	rule->feat = feat;
@@ -426,21 +863,21 @@ static struct grule *font_gpos(struct font *fn, int len, int feat, int scrp, int
 	return rule;
 }
 
-static int font_readgpat(struct font *fn, struct gpat *p, char *s)
+static int font_readgpat(struct fsrc *fs, struct gpat *p, char *s)
 {
 	if (s[0] == '@') {
 		p->g = atoi(s + 1);
-		if (iset_len(fn->ggrp, p->g) == 1)
-			p->g = iset_get(fn->ggrp, p->g)[0];
+		if (iset_len(fs->ggrp, p->g) == 1)
+			p->g = iset_get(fs->ggrp, p->g)[0];
 		else
 			p->flg |= GF_GRP;
 	} else {
-		p->g = font_idx(fn, font_glyph(fn, s));
+		p->g = fsrc_idx(fs, fsrc_glyph(fs, s));
 	}
 	return p->g < 0;
 }
 
-static void font_readfeat(struct font *fn, char *tok, int *feat, int *scrp, int *lang)
+static void font_readfeat(struct fsrc *fs, char *tok, int *feat, int *scrp, int *lang)
 {
 	char *ftag = tok;
 	char *stag = NULL;
@@ -456,68 +893,72 @@ static void font_readfeat(struct font *fn, char *tok, int *feat, int *scrp, int
 		ltag[-1] = '\0';
 	}
 	if (stag)
-		*scrp = font_findscrp(fn, stag);
+		*scrp = font_tag(fs->scrp_name, LEN(fs->scrp_name), stag);
 	if (ltag)
-		*lang = font_findlang(fn, ltag);
-	*feat = font_findfeat(fn, tok);
+		*lang = font_tag(fs->lang_name, LEN(fs->lang_name), ltag);
+	*feat = font_tag(fs->feat_name, LEN(fs->feat_name), tok);
 }
 
-static int font_readgsub(struct font *fn, FILE *fin)
+static int font_readgsub(struct fsrc *fs, FILE *fin)
 {
 	char tok[128];
 	struct grule *rule;
+	struct gpat *pats;
 	int feat, scrp, lang;
 	int i, n;
 	if (fscanf(fin, "%127s %d", tok, &n) != 2)
 		return 1;
-	font_readfeat(fn, tok, &feat, &scrp, &lang);
-	rule = font_gsub(fn, n, feat, scrp, lang);
-	rule->sec = fn->secs;
+	font_readfeat(fs, tok, &feat, &scrp, &lang);
+	rule = font_gsub(fs, n, feat, scrp, lang);
+	rule->sec = fs->secs;
+	pats = fs->pats + rule->pats;
 	for (i = 0; i < n; i++) {
 		if (fscanf(fin, "%127s", tok) != 1)
 			return 1;
 		if (tok[0] == '-')
-			rule->pats[i].flg = GF_PAT;
+			pats[i].flg = GF_PAT;
 		if (tok[0] == '=')
-			rule->pats[i].flg = GF_CON;
+			pats[i].flg = GF_CON;
 		if (tok[0] == '+')
-			rule->pats[i].flg = GF_REP;
-		if (!tok[0] || font_readgpat(fn, &rule->pats[i], tok + 1))
+			pats[i].flg = GF_REP;
+		if (!tok[0] || font_readgpat(fs, &pats[i], tok + 1))
 			return 0;
 	}
 	return 0;
 }
 
-static int font_readgpos(struct font *fn, FILE *fin)
+static int font_readgpos(struct fsrc *fs, FILE *fin)
 {
 	char tok[128];
 	char *col;
 	struct grule *rule;
+	struct gpat *pats;
 	int feat, scrp, lang;
 	int i, n;
 	if (fscanf(fin, "%127s %d", tok, &n) != 2)
 		return 1;
-	font_readfeat(fn, tok, &feat, &scrp, &lang);
-	rule = font_gpos(fn, n, feat, scrp, lang);
-	rule->sec = fn->secs;
+	font_readfeat(fs, tok, &feat, &scrp, &lang);
+	rule = font_gpos(fs, n, feat, scrp, lang);
+	rule->sec = fs->secs;
+	pats = fs->pats + rule->pats;
 	for (i = 0; i < n; i++) {
 		if (fscanf(fin, "%127s", tok) != 1)
 			return 1;
 		col = strchr(tok, ':');
 		if (col)
 			*col = '\0';
-		rule->pats[i].flg = GF_PAT;
-		if (!tok[0] || font_readgpat(fn, &rule->pats[i], tok))
+		pats[i].flg = GF_PAT;
+		if (!tok[0] || font_readgpat(fs, &pats[i], tok))
 			return 0;
 		if (col)
 			sscanf(col + 1, "%hd%hd%hd%hd",
-				&rule->pats[i].x, &rule->pats[i].y,
-				&rule->pats[i].xadv, &rule->pats[i].yadv);
+				&pats[i].x, &pats[i].y,
+				&pats[i].xadv, &pats[i].yadv);
 	}
 	return 0;
 }
 
-static int font_readggrp(struct font *fn, FILE *fin)
+static int font_readggrp(struct fsrc *fs, FILE *fin)
 {
 	char tok[GNLEN];
 	int id, n, i, g;
@@ -526,47 +967,56 @@ static int font_readggrp(struct font *fn, FILE *fin)
 	for (i = 0; i < n; i++) {
 		if (fscanf(fin, GNFMT, tok) != 1)
 			return 1;
-		g = font_idx(fn, font_glyph(fn, tok));
+		g = fsrc_idx(fs, fsrc_glyph(fs, tok));
 		if (g >= 0) {
-			iset_put(fn->ggrp, id, g);
-			iset_put(fn->ggrp_rev, g, id);
+			iset_put(fs->ggrp, id, g);
+			if (id >= fs->ggrp_n && iset_len(fs->ggrp, id))
+				fs->ggrp_n = id + 1;
 		}
 	}
 	return 0;
 }
 
-static int font_readkern(struct font *fn, FILE *fin)
+static int font_readkern(struct fsrc *fs, FILE *fin)
 {
 	char c1[GNLEN], c2[GNLEN];
-	struct grule *rule;
 	int val;
 	if (fscanf(fin, GNFMT " " GNFMT " %d", c1, c2, &val) != 3)
 		return 1;
-	rule = font_gpos(fn, 2, font_findfeat(fn, "kern"), -1, -1);
-	rule->pats[0].g = font_idx(fn, font_glyph(fn, c1));
-	rule->pats[1].g = font_idx(fn, font_glyph(fn, c2));
-	rule->pats[0].xadv = val;
-	rule->pats[0].flg = GF_PAT;
-	rule->pats[1].flg = GF_PAT;
+	font_tag(fs->feat_name, LEN(fs->feat_name), "kern");
+	if (!fsrc_glyph(fs, c1) || !fsrc_glyph(fs, c2))
+		return 0;
+	if (fs->kern_n == fs->kern_sz) {
+		fs->kern_sz = fs->kern_sz + 1024;
+		fs->kern = mextend(fs->kern, fs->kern_n * 3, fs->kern_sz * 3,
+				sizeof(fs->kern[0]));
+	}
+	fs->kern[fs->kern_n * 3 + 0] = fsrc_idx(fs, fsrc_glyph(fs, c1));
+	fs->kern[fs->kern_n * 3 + 1] = fsrc_idx(fs, fsrc_glyph(fs, c2));
+	fs->kern[fs->kern_n * 3 + 2] = val;
+	fs->kern_n++;
 	return 0;
 }
 
-static void font_lig(struct font *fn, char *lig)
+static void font_lig(struct fsrc *fs, char *lig)
 {
 	char c[GNLEN];
 	int g[WORDLEN];
 	struct grule *rule;
+	struct gpat *pats;
 	char *s = lig;
 	int j, n = 0;
 	while (utf8read(&s, c) > 0)
-		g[n++] = font_idx(fn, font_find(fn, c));
-	rule = font_gsub(fn, n + 1, font_findfeat(fn, "liga"), -1, -1);
+		g[n++] = fsrc_idx(fs, fsrc_find(fs, c));
+	rule = font_gsub(fs, n + 1, font_tag(fs->feat_name,
+				LEN(fs->feat_name), "liga"), -1, -1);
+	pats = fs->pats + rule->pats;
 	for (j = 0; j < n; j++) {
-		rule->pats[j].g = g[j];
-		rule->pats[j].flg = GF_PAT;
+		pats[j].g = g[j];
+		pats[j].flg = GF_PAT;
 	}
-	rule->pats[n].g = font_idx(fn, font_find(fn, lig));
-	rule->pats[n].flg = GF_REP;
+	pats[n].g = fsrc_idx(fs, fsrc_find(fs, lig));
+	pats[n].flg = GF_REP;
 }
 
 static void skipline(FILE* filp)
@@ -577,30 +1027,9 @@ static void skipline(FILE* filp)
 	} while (c != '\n' && c != EOF);
 }
 
-static struct gpat *font_rulefirstpat(struct font *fn, struct grule *rule)
+static struct fsrc *font_read(char *path)
 {
-	int i;
-	for (i = 0; i < rule->len; i++)
-		if (!(rule->pats[i].flg & (GF_REP | GF_CON)))
-			return &rule->pats[i];
-	return NULL;
-}
-
-static void font_isetinsert(struct font *fn, struct iset *iset, int rule, struct gpat *p)
-{
-	if (p->flg & GF_GRP) {
-		int *r = iset_get(fn->ggrp, p->g);
-		while (r && *r >= 0)
-			iset_put(iset, *r++, rule);
-	} else {
-		if (p->g >= 0)
-			iset_put(iset, p->g, rule);
-	}
-}
-
-struct font *font_open(char *path)
-{
-	struct font *fn;
+	struct fsrc *fs;
 	int ch_g = -1;		/* last glyph in the charset */
 	int ch_n = 0;			/* number of glyphs in the charset */
 	char tok[128];
@@ -612,87 +1041,799 @@ struct font *font_open(char *path)
 	fin = fopen(path, "r");
 	if (!fin)
 		return NULL;
-	fn = xmalloc(sizeof(*fn));
-	if (!fn) {
-		fclose(fin);
-		return NULL;
-	}
-	memset(fn, 0, sizeof(*fn));
-	fn->gl_dict = dict_make(-1, 1, 0);
-	fn->ch_dict = dict_make(-1, 1, 0);
-	fn->ch_map = dict_make(-1, 1, 0);
-	fn->ggrp = iset_make();
-	fn->ggrp_rev = iset_make();
+	fs = xmalloc(sizeof(*fs));
+	memset(fs, 0, sizeof(*fs));
+	fs->gl_dict = dict_make(-1, 1);
+	fs->ch_dict = dict_make(-1, 1);
+	fs->ch_map = dict_make(-1, 1);
+	fs->ggrp = iset_make();
 	while (fscanf(fin, "%127s", tok) == 1) {
 		if (!strcmp("char", tok)) {
-			font_readchar(fn, fin, &ch_n, &ch_g);
+			font_readchar(fs, fin, &ch_n, &ch_g);
 		} else if (!strcmp("kern", tok)) {
-			font_readkern(fn, fin);
+			font_readkern(fs, fin);
 		} else if (!strcmp("ligatures", tok)) {
 			while (fscanf(fin, "%s", ligs[ligs_n]) == 1) {
 				if (!strcmp("0", ligs[ligs_n]))
 					break;
-				if (ligs_n < LEN(ligs))
+				if (ligs_n < (int) LEN(ligs) - 1)
 					ligs_n++;
 			}
 		} else if (!strcmp("gsec", tok)) {
 			if (fscanf(fin, "%d", &sec) != 1)
-				fn->secs++;
+				fs->secs++;
 		} else if (!strcmp("gsub", tok)) {
-			font_readgsub(fn, fin);
+			font_readgsub(fs, fin);
 		} else if (!strcmp("gpos", tok)) {
-			font_readgpos(fn, fin);
+			font_readgpos(fs, fin);
 		} else if (!strcmp("ggrp", tok)) {
-			font_readggrp(fn, fin);
+			font_readggrp(fs, fin);
 		} else if (!strcmp("spacewidth", tok)) {
-			fscanf(fin, "%d", &fn->spacewid);
+			fscanf(fin, "%d", &fs->spacewid);
 		} else if (!strcmp("special", tok)) {
-			fn->special = 1;
+			fs->special = 1;
 		} else if (!strcmp("name", tok)) {
-			fscanf(fin, "%s", fn->name);
+			fscanf(fin, "%s", fs->name);
 		} else if (!strcmp("fontname", tok)) {
-			fscanf(fin, "%s", fn->fontname);
+			fscanf(fin, "%s", fs->fontname);
 		} else if (!strcmp("charset", tok)) {
-			while (!font_readchar(fn, fin, &ch_n, &ch_g))
+			while (!font_readchar(fs, fin, &ch_n, &ch_g))
 				;
 			break;
 		}
 		skipline(fin);
 	}
 	for (i = 0; i < ligs_n; i++)
-		font_lig(fn, ligs[i]);
+		font_lig(fs, ligs[i]);
 	fclose(fin);
-	fn->gsub0 = iset_make();
-	fn->gpos0 = iset_make();
-	for (i = 0; i < fn->gsub_n; i++)
-		font_isetinsert(fn, fn->gsub0, i,
-			font_rulefirstpat(fn, &fn->gsub[i]));
-	for (i = 0; i < fn->gpos_n; i++)
-		font_isetinsert(fn, fn->gpos0, i,
-			font_rulefirstpat(fn, &fn->gpos[i]));
+	return fs;
+}
+
+/*
+ * return 1 if the font at path is special, 0 if not, and -1 if missing
+ *
+ * Only the header of the font, before its glyphs and rules, is read.
+ */
+int font_isspecial(char *path)
+{
+	char tok[128];
+	FILE *fin = fopen(path, "r");
+	int special = 0;
+	if (!fin)
+		return -1;
+	while (!special && fscanf(fin, "%127s", tok) == 1) {
+		if (!strcmp("special", tok))
+			special = 1;
+		if (!strcmp("charset", tok) || !strcmp("char", tok) ||
+				!strcmp("kern", tok) || !strcmp("gsub", tok) ||
+				!strcmp("gpos", tok) || !strcmp("ggrp", tok) ||
+				!strcmp("gsec", tok))
+			break;
+		if (!strcmp("ligatures", tok))
+			while (fscanf(fin, "%127s", tok) == 1 && strcmp("0", tok))
+				;
+		skipline(fin);
+	}
+	fclose(fin);
+	return special;
+}
+
+static void fsrc_free(struct fsrc *fs)
+{
+	dict_free(fs->gl_dict);
+	dict_free(fs->ch_dict);
+	dict_free(fs->ch_map);
+	iset_free(fs->ggrp);
+	free(fs->al);
+	free(fs->gsub);
+	free(fs->gpos);
+	free(fs->kern);
+	free(fs->pats);
+	free(fs->gl);
+	free(fs);
+}
+
+/* compiling font descriptions */
+
+/* a growing memory block */
+struct fbuf {
+	char *buf;
+	long len, sz;
+};
+
+/* append string s to b; return its offset */
+static long fbuf_str(struct fbuf *b, char *s)
+{
+	long off = b->len;
+	long n = strlen(s) + 1;
+	if (off + n > b->sz) {
+		long sz = MAX(b->sz * 2, off + n + 4096);
+		b->buf = mextend(b->buf, b->sz, sz, 1);
+		b->sz = sz;
+	}
+	memcpy(b->buf + off, s, n);
+	b->len = off + n;
+	return off;
+}
+
+/* append n bytes of d (zeros if NULL) to b, aligned to 8; return its offset */
+static long fbuf_put(struct fbuf *b, void *d, long n)
+{
+	long off = (b->len + 7) & ~7l;
+	if (off + n > b->sz) {
+		long sz = MAX(b->sz * 2, off + n + 4096);
+		b->buf = mextend(b->buf, b->sz, sz, 1);
+		b->sz = sz;
+	}
+	if (d)
+		memcpy(b->buf + off, d, n);
+	else
+		memset(b->buf + off, 0, n);
+	b->len = off + n;
+	return off;
+}
+
+/* insert key in hash table tab; the keys are offsets in the string pool */
+static void font_hput(int *tab, char *str, int key, int val)
+{
+	int mask = tab[0] - 1;
+	int i = font_hash(str + key) & mask;
+	while (tab[1 + i * 2] && strcmp(str + tab[1 + i * 2], str + key))
+		i = (i + 1) & mask;
+	tab[1 + i * 2] = key;
+	tab[2 + i * 2] = val;
+}
+
+/* create an empty hash table for n keys */
+static long font_hmake(struct fbuf *img, int n)
+{
+	int slots = 16;
+	long off;
+	while (slots < n * 2)
+		slots <<= 1;
+	off = fbuf_put(img, NULL, (1 + slots * 2) * sizeof(int));
+	((int *) (img->buf + off))[0] = slots;
+	return off;
+}
+
+/* save each set as a bitset covering the range of its members */
+static long font_bitsput(struct fbuf *img, struct iset *set, int n)
+{
+	long off;
+	int *tab;
+	int i, j, pos = 1 + n * 3;
+	for (i = 0; i < n; i++) {
+		int *r = iset_get(set, i);
+		int lo = -1, hi = -1;
+		for (j = 0; r && r[j] >= 0; j++) {
+			lo = lo < 0 || r[j] < lo ? r[j] : lo;
+			hi = r[j] > hi ? r[j] : hi;
+		}
+		if (lo >= 0)
+			pos += (hi - lo) / 32 + 1;
+	}
+	off = fbuf_put(img, NULL, pos * sizeof(int));
+	tab = (void *) (img->buf + off);
+	tab[0] = n;
+	pos = 1 + n * 3;
+	for (i = 0; i < n; i++) {
+		int *r = iset_get(set, i);
+		int *ent = tab + 1 + i * 3;
+		unsigned *bits = (unsigned *) tab + pos;
+		int lo = -1, hi = -1;
+		for (j = 0; r && r[j] >= 0; j++) {
+			lo = lo < 0 || r[j] < lo ? r[j] : lo;
+			hi = r[j] > hi ? r[j] : hi;
+		}
+		if (lo < 0)
+			continue;
+		ent[0] = lo;
+		ent[1] = hi + 1;
+		ent[2] = pos;
+		for (j = 0; r[j] >= 0; j++)
+			bits[(r[j] - lo) / 32] |= 1u << ((r[j] - lo) % 32);
+		pos += (hi - lo) / 32 + 1;
+	}
+	return off;
+}
+
+/* save kerning pairs in a hash table; repeated pairs are added */
+static long font_kernput(struct fbuf *img, int *kern, int n)
+{
+	int slots = 16;
+	long off;
+	int *tab;
+	int i, j;
+	while (slots < n * 2)
+		slots <<= 1;
+	off = fbuf_put(img, NULL, (1 + slots * 3) * sizeof(int));
+	tab = (void *) (img->buf + off);
+	tab[0] = slots;
+	for (i = 0; i < slots; i++)
+		tab[1 + i * 3] = -1;
+	for (i = 0; i < n; i++) {
+		int g1 = kern[i * 3], g2 = kern[i * 3 + 1];
+		j = font_kernhash(g1, g2) & (slots - 1);
+		while (tab[1 + j * 3] >= 0 && (tab[1 + j * 3] != g1 ||
+				tab[2 + j * 3] != g2))
+			j = (j + 1) & (slots - 1);
+		tab[1 + j * 3] = g1;
+		tab[2 + j * 3] = g2;
+		tab[3 + j * 3] += kern[i * 3 + 2];
+	}
+	return off;
+}
+
+/* save set as a list of -1 terminated lists for keys 0 to n - 1 */
+static long font_setput(struct fbuf *img, struct iset *set, int n)
+{
+	long off;
+	int *tab;
+	int i, pos = 1 + n + 1;
+	for (i = 0; i < n; i++)
+		pos += iset_len(set, i) + 1;
+	off = fbuf_put(img, NULL, pos * sizeof(int));
+	tab = (void *) (img->buf + off);
+	tab[0] = n;
+	pos = 1 + n;
+	tab[pos] = -1;			/* the empty list */
+	pos++;
+	for (i = 0; i < n; i++) {
+		int len = iset_len(set, i);
+		tab[1 + i] = len ? pos : 1 + n;
+		if (len) {
+			memcpy(tab + pos, iset_get(set, i), len * sizeof(int));
+			tab[pos + len] = -1;
+			pos += len + 1;
+		}
+	}
+	return off;
+}
+
+/* compile the font description into a font image */
+static struct fimg *font_compile(struct fsrc *fs)
+{
+	struct fbuf img = {NULL};
+	struct fbuf str = {NULL};
+	struct fimg hdr;
+	struct fglyph *fg;
+	int *gl_id, *gl_name, *al_name;
+	int i;
+	memset(&hdr, 0, sizeof(hdr));
+	fbuf_put(&img, NULL, sizeof(hdr));
+	fbuf_str(&str, "");		/* offset zero marks empty slots */
+	/* the string pool */
+	gl_id = xmalloc((fs->gl_n + 1) * sizeof(gl_id[0]));
+	gl_name = xmalloc((fs->gl_n + 1) * sizeof(gl_name[0]));
+	al_name = xmalloc((fs->al_n + 1) * sizeof(al_name[0]));
+	for (i = 0; i < fs->gl_n; i++) {
+		gl_id[i] = fbuf_str(&str, fs->gl[i].id);
+		gl_name[i] = fbuf_str(&str, fs->gl[i].name);
+	}
+	for (i = 0; i < fs->al_n; i++)
+		al_name[i] = fbuf_str(&str, fs->al[i].name);
+	hdr.str = fbuf_put(&img, str.buf, str.len);
+	/* glyphs */
+	hdr.gl = fbuf_put(&img, NULL, fs->gl_n * sizeof(*fg));
+	fg = (void *) (img.buf + hdr.gl);
+	for (i = 0; i < fs->gl_n; i++) {
+		fg[i].id = gl_id[i];
+		fg[i].name = gl_name[i];
+		fg[i].wid = fs->gl[i].wid;
+		fg[i].llx = fs->gl[i].llx;
+		fg[i].lly = fs->gl[i].lly;
+		fg[i].urx = fs->gl[i].urx;
+		fg[i].ury = fs->gl[i].ury;
+		fg[i].type = fs->gl[i].type;
+	}
+	/* hash tables; later duplicate keys replace the previous ones */
+	hdr.gl_tab = font_hmake(&img, fs->gl_n);
+	hdr.ch_tab = font_hmake(&img, fs->gl_n);
+	hdr.al_tab = font_hmake(&img, fs->al_n);
+	for (i = 0; i < fs->gl_n; i++)
+		font_hput((void *) (img.buf + hdr.gl_tab), str.buf, gl_id[i], i);
+	for (i = 0; i < fs->gl_n; i++)
+		font_hput((void *) (img.buf + hdr.ch_tab), str.buf, gl_name[i], i);
+	for (i = 0; i < fs->al_n; i++)
+		if (fs->al[i].g >= 0)
+			font_hput((void *) (img.buf + hdr.al_tab), str.buf,
+				al_name[i], fs->al[i].g);
+	/* glyph substitution and positioning rules */
+	hdr.gsub = fbuf_put(&img, fs->gsub, fs->gsub_n * sizeof(fs->gsub[0]));
+	hdr.gpos = fbuf_put(&img, fs->gpos, fs->gpos_n * sizeof(fs->gpos[0]));
+	hdr.pats = fbuf_put(&img, fs->pats, fs->pats_n * sizeof(fs->pats[0]));
+	hdr.ggrp = font_setput(&img, fs->ggrp, fs->ggrp_n);
+	hdr.ggrp_bits = font_bitsput(&img, fs->ggrp, fs->ggrp_n);
+	hdr.kern = font_kernput(&img, fs->kern, fs->kern_n);
+	/* the header */
+	memcpy(hdr.magic, FI_MAGIC, sizeof(hdr.magic));
+	hdr.hdrsz = sizeof(hdr);
+	hdr.size = img.len;
+	memcpy(hdr.name, fs->name, sizeof(hdr.name));
+	memcpy(hdr.fontname, fs->fontname, sizeof(hdr.fontname));
+	hdr.spacewid = fs->spacewid;
+	hdr.special = fs->special;
+	memcpy(hdr.feat_name, fs->feat_name, sizeof(hdr.feat_name));
+	memcpy(hdr.scrp_name, fs->scrp_name, sizeof(hdr.scrp_name));
+	memcpy(hdr.lang_name, fs->lang_name, sizeof(hdr.lang_name));
+	hdr.gl_n = fs->gl_n;
+	hdr.gsub_n = fs->gsub_n;
+	hdr.gpos_n = fs->gpos_n;
+	hdr.kern_n = fs->kern_n;
+	hdr.str_n = str.len;
+	hdr.pats_n = fs->pats_n;
+	memcpy(img.buf, &hdr, sizeof(hdr));
+	free(gl_id);
+	free(gl_name);
+	free(al_name);
+	free(str.buf);
+	return (void *) img.buf;
+}
+
+/* the path of the compiled font in the cache directory; nonzero if too long */
+static int font_cpath(char *dst, char *path)
+{
+	char *base = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	return snprintf(dst, PATHLEN, "%s/%s-%08lx.fc", font_cdir, base,
+		font_hash(path) & 0xffffffffl) >= PATHLEN;
+}
+
+/* the address of len bytes at off in img or NULL if not inside it */
+static void *fimg_sec(struct fimg *img, long off, long len)
+{
+	if (off < img->hdrsz || off % sizeof(int) || len < 0 ||
+			len > img->size - off)
+		return NULL;
+	return (char *) img + off;
+}
+
+/* check an image hash table of strings mapping to glyph indices */
+static int fimg_badtab(struct fimg *img, long off, int vals)
+{
+	int *tab = fimg_sec(img, off, sizeof(int));
+	int i, empty = 0;
+	if (!tab || tab[0] <= 0 || tab[0] & (tab[0] - 1) ||
+			!(tab = fimg_sec(img, off, (1 + tab[0] * 2l) * sizeof(int))))
+		return 1;
+	for (i = 0; i < tab[0]; i++) {
+		int key = tab[1 + i * 2], val = tab[2 + i * 2];
+		if (!key)
+			empty++;
+		if (key < 0 || key >= img->str_n ||
+				(key && (val < 0 || val >= vals)))
+			return 1;
+	}
+	return !empty;
+}
+
+/* check the glyph groups, saved by font_setput() and font_bitsput() */
+static int fimg_badggrp(struct fimg *img)
+{
+	int *set = fimg_sec(img, img->ggrp, sizeof(int));
+	int *bits = fimg_sec(img, img->ggrp_bits, sizeof(int));
+	long len;
+	int i, j;
+	if (!set || set[0] < 0 ||
+			!(set = fimg_sec(img, img->ggrp, (1l + set[0]) * sizeof(int))))
+		return 1;
+	len = (img->size - img->ggrp) / sizeof(int);
+	for (i = 0; i < set[0]; i++) {
+		if (set[1 + i] <= set[0] || set[1 + i] >= len)
+			return 1;
+		for (j = set[1 + i]; j < len && set[j] >= 0; j++)
+			if (set[j] >= img->gl_n)
+				return 1;
+		if (j == len)
+			return 1;
+	}
+	if (!bits || bits[0] != set[0] ||
+			!(bits = fimg_sec(img, img->ggrp_bits,
+				(1 + bits[0] * 3l) * sizeof(int))))
+		return 1;
+	len = (img->size - img->ggrp_bits) / sizeof(int);
+	for (i = 0; i < bits[0]; i++) {
+		int *ent = bits + 1 + i * 3;
+		if (ent[0] >= ent[1])
+			continue;
+		if (ent[0] < 0 || ent[2] <= bits[0] * 3 || ent[2] >= len ||
+				((long) ent[1] - ent[0] - 1) / 32 >= len - ent[2])
+			return 1;
+	}
+	return 0;
+}
+
+/* check the rules of a gsub or gpos section */
+static int fimg_badrules(struct fimg *img, long off, int n)
+{
+	struct grule *rules = (void *) ((char *) img + off);
+	int i;
+	if (!fimg_sec(img, off, n * (long) sizeof(*rules)))
+		return 1;
+	for (i = 0; i < n; i++) {
+		struct grule *r = &rules[i];
+		if (r->pats < 0 || r->len < 0 || r->len > img->pats_n - r->pats ||
+				r->feat < -1 || r->feat >= NFEATS ||
+				r->scrp < -1 || r->scrp >= NSCRPS ||
+				r->lang < -1 || r->lang >= NLANGS)
+			return 1;
+	}
+	return 0;
+}
+
+/*
+ * check that the sections of a mapped image lie inside it
+ *
+ * Offsets, counts, and indices that are followed when using the font
+ * are checked, so that corrupt files cannot cause reads outside the
+ * image or the glyph array.
+ */
+static int font_imgbad(struct fimg *img)
+{
+	struct fglyph *fg = (void *) ((char *) img + img->gl);
+	struct gpat *pats = (void *) ((char *) img + img->pats);
+	char *str = (char *) img + img->str;
+	int *kern = fimg_sec(img, img->kern, sizeof(int));
+	int ngrp;
+	int i;
+	if (img->gl_n < 0 || img->str_n <= 0 || img->pats_n < 0 ||
+			img->gsub_n < 0 || img->gpos_n < 0 || img->kern_n < 0)
+		return 1;
+	if (!memchr(img->name, '\0', sizeof(img->name)) ||
+			!memchr(img->fontname, '\0', sizeof(img->fontname)) ||
+			!memchr(img->src, '\0', sizeof(img->src)))
+		return 1;
+	for (i = 0; i < NFEATS; i++)
+		if (!memchr(img->feat_name[i], '\0', sizeof(img->feat_name[i])))
+			return 1;
+	for (i = 0; i < NSCRPS; i++)
+		if (!memchr(img->scrp_name[i], '\0', sizeof(img->scrp_name[i])))
+			return 1;
+	for (i = 0; i < NLANGS; i++)
+		if (!memchr(img->lang_name[i], '\0', sizeof(img->lang_name[i])))
+			return 1;
+	if (!fimg_sec(img, img->str, img->str_n) ||
+			str[img->str_n - 1])
+		return 1;
+	if (!fimg_sec(img, img->gl, img->gl_n * (long) sizeof(*fg)))
+		return 1;
+	for (i = 0; i < img->gl_n; i++)
+		if (fg[i].id < 0 || fg[i].id >= img->str_n ||
+				fg[i].name < 0 || fg[i].name >= img->str_n)
+			return 1;
+	if (fimg_badtab(img, img->gl_tab, img->gl_n) ||
+			fimg_badtab(img, img->ch_tab, img->gl_n) ||
+			fimg_badtab(img, img->al_tab, img->gl_n))
+		return 1;
+	if (fimg_badggrp(img))
+		return 1;
+	ngrp = ((int *) ((char *) img + img->ggrp))[0];
+	if (!fimg_sec(img, img->pats, img->pats_n * (long) sizeof(*pats)))
+		return 1;
+	for (i = 0; i < img->pats_n; i++)
+		if (pats[i].flg & GF_GRP ? pats[i].g < 0 || pats[i].g >= ngrp :
+				pats[i].g < -1 || pats[i].g >= img->gl_n)
+			return 1;
+	if (fimg_badrules(img, img->gsub, img->gsub_n) ||
+			fimg_badrules(img, img->gpos, img->gpos_n))
+		return 1;
+	if (!kern || kern[0] <= 0 || kern[0] & (kern[0] - 1) ||
+			!fimg_sec(img, img->kern, (1 + kern[0] * 3l) * sizeof(int)))
+		return 1;
+	for (i = 0; i < kern[0]; i++)	/* lookups stop at empty slots */
+		if (kern[1 + i * 3] < 0)
+			return 0;
+	return 1;
+}
+
+/* map the compiled font at cpath, if it is up to date */
+static struct fimg *font_cacheload(char *cpath, char *path, struct stat *st)
+{
+	struct fimg *img;
+	struct stat cst;
+	int fd = open(cpath, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &cst) < 0 || cst.st_size < (off_t) sizeof(*img)) {
+		close(fd);
+		return NULL;
+	}
+	img = mmap(NULL, cst.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return NULL;
+	if (memcmp(img->magic, FI_MAGIC, sizeof(img->magic)) ||
+			img->hdrsz != sizeof(*img) || img->size != cst.st_size ||
+			img->src_mtime != st->st_mtime ||
+			img->src_size != st->st_size || strcmp(img->src, path) ||
+			font_imgbad(img)) {
+		munmap(img, cst.st_size);
+		return NULL;
+	}
+	return img;
+}
+
+/* save the compiled font; a temporary file is renamed for atomicity */
+static void font_cachesave(struct fimg *img, char *cpath)
+{
+	char tmp[PATHLEN + 32];
+	int fd;
+	snprintf(tmp, sizeof(tmp), "%s.%d", cpath, (int) getpid());
+	if ((fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return;
+	if (write(fd, img, img->size) != img->size || close(fd) < 0 ||
+			rename(tmp, cpath) < 0)
+		unlink(tmp);
+}
+
+/* set the directory for saving compiled fonts */
+void font_cache(char *dir)
+{
+	snprintf(font_cdir, sizeof(font_cdir), "%s", dir ? dir : "");
+}
+
+/* create a registry entry for the given font image */
+static struct fdata *font_data(struct fimg *img, int mapped)
+{
+	struct fdata *fd = xmalloc(sizeof(*fd));
+	struct fglyph *fg = (void *) ((char *) img + img->gl);
+	char *str = (char *) img + img->str;
+	int i;
+	memset(fd, 0, sizeof(*fd));
+	fd->img = img;
+	fd->img_mapped = mapped;
+	fd->gl = xmalloc((img->gl_n + 1) * sizeof(fd->gl[0]));
+	memset(fd->gl, 0, (img->gl_n + 1) * sizeof(fd->gl[0]));
+	for (i = 0; i < img->gl_n; i++) {
+		struct glyph *g = &fd->gl[i];
+		g->id = str + fg[i].id;
+		g->name = str + fg[i].name;
+		g->wid = fg[i].wid;
+		g->llx = fg[i].llx;
+		g->lly = fg[i].lly;
+		g->urx = fg[i].urx;
+		g->ury = fg[i].ury;
+		g->type = fg[i].type;
+	}
+	return fd;
+}
+
+static void font_datafree(struct fdata *fd)
+{
+	if (fd->img_mapped)
+		munmap(fd->img, fd->img->size);
+	else
+		free(fd->img);
+	free(fd->gl);
+	free(fd);
+}
+
+/* remove unused registry entries, if stale or too many */
+static void font_regclean(void)
+{
+	struct fdata **fd = &font_reg;
+	int idle = 0;
+	while (*fd) {
+		struct fdata *cur = *fd;
+		if (!cur->ref && (cur->stale || ++idle > NIDLE)) {
+			*fd = cur->next;
+			font_datafree(cur);
+		} else {
+			fd = &cur->next;
+		}
+	}
+}
+
+/* mount the font in the registry entry fd */
+static struct font *font_load(struct fdata *fd)
+{
+	struct font *fn = xmalloc(sizeof(*fn));
+	struct fimg *img = fd->img;
+	int i;
+	memset(fn, 0, sizeof(*fn));
+	font_szclear(fn);
+	fn->fd = fd;
+	fd->ref++;
+	memcpy(fn->name, img->name, sizeof(fn->name));
+	memcpy(fn->fontname, img->fontname, sizeof(fn->fontname));
+	fn->spacewid = img->spacewid;
+	fn->special = img->special;
+	memcpy(fn->feat_name, img->feat_name, sizeof(fn->feat_name));
+	memcpy(fn->scrp_name, img->scrp_name, sizeof(fn->scrp_name));
+	memcpy(fn->lang_name, img->lang_name, sizeof(fn->lang_name));
+	fn->str = (char *) img + img->str;
+	fn->gl_tab = (void *) ((char *) img + img->gl_tab);
+	fn->ch_tab = (void *) ((char *) img + img->ch_tab);
+	fn->al_tab = (void *) ((char *) img + img->al_tab);
+	fn->gsub = (void *) ((char *) img + img->gsub);
+	fn->gsub_n = img->gsub_n;
+	fn->gpos = (void *) ((char *) img + img->gpos);
+	fn->gpos_n = img->gpos_n;
+	fn->kern_feat = font_tag(fn->feat_name, LEN(fn->feat_name), "kern");
+	if (img->kern_n && fn->kern_feat >= 0)
+		fn->kern = (void *) ((char *) img + img->kern);
+	fn->pats = (void *) ((char *) img + img->pats);
+	fn->ggrp = (void *) ((char *) img + img->ggrp);
+	fn->ggrp_bits = (void *) ((char *) img + img->ggrp_bits);
+	/* glyphs refer to the mounted font */
+	fn->gl_n = img->gl_n;
+	fn->gl = xmalloc((fn->gl_n + 1) * sizeof(fn->gl[0]));
+	memcpy(fn->gl, fd->gl, (fn->gl_n + 1) * sizeof(fn->gl[0]));
+	for (i = 0; i < fn->gl_n; i++)
+		fn->gl[i].font = fn;
+	fn->ch_map = dict_make(-1, 1);
 	fn->scrp = -1;
 	fn->lang = -1;
 	return fn;
 }
 
+/* the resolved path of a font and its status */
+static int font_resolve(char *path, char *rpath, struct stat *st)
+{
+	if (stat(path, st) < 0)
+		return 1;
+	if (strlen(path) >= PATHLEN || !realpath(path, rpath))
+		snprintf(rpath, PATHLEN, "%s", path);
+	return 0;
+}
+
+/* find an up-to-date font in the registry */
+static struct fdata *font_regfind(char *path, struct stat *st)
+{
+	struct fdata *fd;
+	for (fd = font_reg; fd; fd = fd->next) {
+		if (!fd->stale && !strcmp(fd->img->src, path)) {
+			if (fd->img->src_mtime == st->st_mtime &&
+					fd->img->src_size == st->st_size)
+				return fd;
+			fd->stale = 1;	/* the font has been modified */
+		}
+	}
+	return NULL;
+}
+
+static struct fdata *font_regadd(struct fimg *img, int mapped)
+{
+	struct fdata *fd = font_data(img, mapped);
+	fd->next = font_reg;
+	font_reg = fd;
+	return fd;
+}
+
+/* load the compiled font from the cache or compile it; thread-safe */
+static struct fimg *font_image(char *path, struct stat *st, int *mapped)
+{
+	char cpath[PATHLEN];
+	struct fsrc *fs;
+	struct fimg *img;
+	int cache = font_cdir[0] && !font_cpath(cpath, path);
+	*mapped = 0;
+	if (cache && (img = font_cacheload(cpath, path, st))) {
+		*mapped = 1;
+		return img;
+	}
+	if (!(fs = font_read(path)))
+		return NULL;
+	img = font_compile(fs);
+	fsrc_free(fs);
+	img->src_mtime = st->st_mtime;
+	img->src_size = st->st_size;
+	snprintf(img->src, sizeof(img->src), "%s", path);
+	if (cache)
+		font_cachesave(img, cpath);
+	return img;
+}
+
+/* open a font; fonts are shared via a registry keyed by their path */
+struct font *font_open(char *path)
+{
+	char rpath[PATHLEN];
+	struct fdata *fd;
+	struct fimg *img;
+	struct stat st;
+	int mapped;
+	if (font_resolve(path, rpath, &st))
+		return NULL;
+	if ((fd = font_regfind(rpath, &st)))
+		return font_load(fd);
+	font_regclean();
+	if (!(img = font_image(rpath, &st, &mapped)))
+		return NULL;
+	return font_load(font_regadd(img, mapped));
+}
+
+/* fonts loaded by font_preload() */
+struct fpreload {
+	char path[PATHLEN];
+	struct stat st;
+	struct fimg *img;
+	int mapped;
+};
+
+/* the work queue of font_preload() */
+struct fqueue {
+	struct fpreload *fonts;
+	int n;
+	int next;			/* the next font to load */
+	pthread_mutex_t lock;
+};
+
+static void *font_worker(void *arg)
+{
+	struct fqueue *q = arg;
+	while (1) {
+		struct fpreload *f;
+		pthread_mutex_lock(&q->lock);
+		f = q->next < q->n ? &q->fonts[q->next++] : NULL;
+		pthread_mutex_unlock(&q->lock);
+		if (!f)
+			break;
+		f->img = font_image(f->path, &f->st, &f->mapped);
+	}
+	return NULL;
+}
+
+/* load the given fonts into the registry using the given number of threads */
+void font_preload(char **paths, int n, int threads)
+{
+	pthread_t *th = xmalloc(MAX(1, threads) * sizeof(th[0]));
+	struct fqueue q;
+	int i, j;
+	q.fonts = xmalloc(MAX(1, n) * sizeof(q.fonts[0]));
+	q.n = 0;
+	q.next = 0;
+	pthread_mutex_init(&q.lock, NULL);
+	for (i = 0; i < n; i++) {
+		struct fpreload *f = &q.fonts[q.n];
+		if (font_resolve(paths[i], f->path, &f->st))
+			continue;
+		if (font_regfind(f->path, &f->st))
+			continue;
+		for (j = 0; j < q.n; j++)
+			if (!strcmp(q.fonts[j].path, f->path))
+				break;
+		if (j == q.n)
+			q.n++;
+	}
+	for (i = 0; i < threads - 1; i++)
+		if (pthread_create(&th[i], NULL, font_worker, &q))
+			break;
+	threads = i;
+	font_worker(&q);	/* the calling thread is a worker too */
+	for (i = 0; i < threads; i++)
+		pthread_join(th[i], NULL);
+	/* adding fonts to the registry in order */
+	for (i = 0; i < q.n; i++)
+		if (q.fonts[i].img)
+			font_regadd(q.fonts[i].img, q.fonts[i].mapped);
+	pthread_mutex_destroy(&q.lock);
+	free(q.fonts);
+	free(th);
+}
+
 void font_close(struct font *fn)
 {
 	int i;
-	for (i = 0; i < fn->gsub_n; i++)
-		free(fn->gsub[i].pats);
-	for (i = 0; i < fn->gpos_n; i++)
-		free(fn->gpos[i].pats);
-	dict_free(fn->gl_dict);
-	dict_free(fn->ch_dict);
 	dict_free(fn->ch_map);
-	iset_free(fn->gsub0);
-	iset_free(fn->gpos0);
-	iset_free(fn->ggrp);
-	iset_free(fn->ggrp_rev);
-	free(fn->gsub);
-	free(fn->gpos);
+	for (i = 0; i < fn->plans_n; i++) {
+		iset_free(fn->plans[i].gsub0);
+		iset_free(fn->plans[i].gpos0);
+	}
+	font_lcclear(fn);
+	font_szclear(fn);
+	fn->fd->ref--;
 	free(fn->gl);
 	free(fn);
+	font_regclean();
+}
+
+/* free the font registry; called after closing all fonts */
+void font_done(void)
+{
+	while (font_reg) {
+		struct fdata *fd = font_reg;
+		font_reg = fd->next;
+		font_datafree(fd);
+	}
 }
 
 int font_special(struct font *fn)
@@ -720,6 +1861,80 @@ static int font_twid(struct font *fn, int sz)
 	return 0;
 }
 
+static void font_szclear(struct font *fn)
+{
+	int i;
+	for (i = 0; i < NSIZES; i++) {
+		free(fn->sizes[i].wid);
+		free(fn->sizes[i].box);
+		free(fn->sizes[i].set);
+	}
+	memset(fn->sizes, 0, sizeof(fn->sizes));
+	for (i = 0; i < NSIZES; i++)
+		fn->sizes[i].sz = -1;
+}
+
+/* scaled metrics of the given size */
+static struct fsize *font_size(struct font *fn, int sz)
+{
+	struct fsize *fz;
+	int i;
+	for (i = 0; i < NSIZES; i++)
+		if (fn->sizes[i].sz == sz)
+			return &fn->sizes[i];
+	fz = &fn->sizes[fn->sizes_cur];
+	fn->sizes_cur = (fn->sizes_cur + 1) % NSIZES;
+	if (!fz->wid) {
+		fz->wid = xmalloc(fn->gl_n * sizeof(fz->wid[0]) + 1);
+		fz->box = xmalloc(fn->gl_n * 4 * sizeof(fz->box[0]) + 1);
+		fz->set = xmalloc(fn->gl_n + 1);
+	}
+	memset(fz->set, 0, fn->gl_n);
+	fz->sz = sz;
+	fz->twid = font_twid(fn, sz);
+	fz->ss[0] = -1;
+	fz->ss[1] = -1;
+	return fz;
+}
+
+/* fill the scaled metrics of glyph i */
+static void font_sizeglyph(struct font *fn, struct fsize *fz, int i)
+{
+	struct glyph *g = &fn->gl[i];
+	fz->wid[i] = font_wid(fn, fz->sz, g->wid);
+	fz->box[i * 4 + 0] = font_wid(fn, fz->sz, g->llx);
+	fz->box[i * 4 + 1] = font_wid(fn, fz->sz, g->lly);
+	fz->box[i * 4 + 2] = font_wid(fn, fz->sz, g->urx);
+	fz->box[i * 4 + 3] = font_wid(fn, fz->sz, g->ury);
+	fz->set[i] = 1;
+}
+
+/* the width of glyph g for size sz, if the current font is cfn */
+int font_glwid(struct glyph *g, struct font *cfn, int sz)
+{
+	struct font *fn = g->font;
+	struct font *xfn = cfn ? cfn : fn;
+	struct fsize *fz;
+	int i = g - fn->gl;
+	if (xfn->cs)
+		return font_gwid(fn, cfn, sz, g->wid);
+	fz = font_size(fn, sz);
+	if (!fz->set[i])
+		font_sizeglyph(fn, fz, i);
+	return fz->wid[i] + (cfn ? fz->twid : 0) + (xfn->bd ? xfn->bd - 1 : 0);
+}
+
+/* the bounding box of glyph g (llx, lly, urx, and ury) for size sz */
+void font_glbox(struct glyph *g, int sz, int *box)
+{
+	struct font *fn = g->font;
+	struct fsize *fz = font_size(fn, sz);
+	int i = g - fn->gl;
+	if (!fz->set[i])
+		font_sizeglyph(fn, fz, i);
+	memcpy(box, fz->box + i * 4, 4 * sizeof(box[0]));
+}
+
 /* glyph width, where cfn is the current font and fn is glyph's font */
 int font_gwid(struct font *fn, struct font *cfn, int sz, int w)
 {
@@ -734,7 +1949,18 @@ int font_gwid(struct font *fn, struct font *cfn, int sz, int w)
 /* space width for the give word space or sentence space */
 int font_swid(struct font *fn, int sz, int ss)
 {
-	return font_gwid(fn, NULL, sz, (fn->spacewid * ss + 6) / 12);
+	struct fsize *fz;
+	int i;
+	if (fn->cs)
+		return font_gwid(fn, NULL, sz, (fn->spacewid * ss + 6) / 12);
+	fz = font_size(fn, sz);
+	for (i = 0; i < 2; i++)
+		if (fz->ss[i] == ss)
+			return fz->swid[i];
+	i = fz->ss[0] >= 0;
+	fz->ss[i] = ss;
+	fz->swid[i] = font_gwid(fn, NULL, sz, (fn->spacewid * ss + 6) / 12);
+	return fz->swid[i];
 }
 
 int font_getcs(struct font *fn)
@@ -746,6 +1972,7 @@ void font_setcs(struct font *fn, int cs, int ps)
 {
 	fn->cs = cs;
 	fn->cs_ps = ps;
+	font_szclear(fn);
 }
 
 int font_getbd(struct font *fn)
@@ -756,6 +1983,7 @@ int font_getbd(struct font *fn)
 void font_setbd(struct font *fn, int bd)
 {
 	fn->bd = bd;
+	font_szclear(fn);
 }
 
 void font_track(struct font *fn, int s1, int n1, int s2, int n2)
@@ -764,6 +1992,7 @@ void font_track(struct font *fn, int s1, int n1, int s2, int n2)
 	fn->n1 = n1;
 	fn->s2 = s2;
 	fn->n2 = n2;
+	font_szclear(fn);
 }
 
 int font_zoom(struct font *fn, int sz)
@@ -774,26 +2003,28 @@ int font_zoom(struct font *fn, int sz)
 void font_setzoom(struct font *fn, int zoom)
 {
 	fn->zoom = zoom;
+	font_szclear(fn);
 }
 
 /* enable/disable font features; returns the previous value */
 int font_feat(struct font *fn, char *name, int val)
 {
-	int idx = font_findfeat(fn, name);
-	int old = idx >= 0 ? fn->feat_set[idx] : 0;
-	if (idx >= 0)
-		fn->feat_set[idx] = val != 0;
-	return old;
+	font_lcclear(fn);
+	return font_featset(fn, name, val);
 }
 
 /* set font script */
 void font_scrp(struct font *fn, char *name)
 {
+	font_lcclear(fn);
 	fn->scrp = name ? font_findscrp(fn, name) : -1;
+	fn->plan = NULL;
 }
 
 /* set font language */
 void font_lang(struct font *fn, char *name)
 {
+	font_lcclear(fn);
 	fn->lang = name ? font_findlang(fn, name) : -1;
+	fn->plan = NULL;
 }
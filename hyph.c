@@ -1,23 +1,68 @@
 /* hyphenation */
 #include <ctype.h>
+#include <fcntl.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "roff.h"
-#include "hyen.h"
+#include "hyenc.h"
 
-#define HYPATLEN	(NHYPHS * 16)	/* hyphenation pattern length */
+#define HYEND		10	/* terminates the numbers of a pattern */
+#define HCMAX		0x110000	/* code points in .hcode page tables */
 
 static void hcode_strcpy(char *d, char *s, int *map, int dots);
 static int hcode_mapchar(char *s);
+static void hcache_clear(void);
 
-/* the hyphenation dictionary (.hw) */
+/*
+ * The tables of patterns and exceptions are either read-only ones (the
+ * builtin english tables compiled by mkhyen in hyenc.h or those of a
+ * mapped compiled hyphenation file) or those in hl->hytrie/hl->hwtrie, which are
+ * built from requests.  Modifying read-only tables copies them first.
+ *
+ * Each hyphenation language (.hla) has its own tables; hyphenate() and
+ * hyphenation requests use those of the language of the current
+ * environment (hl).
+ */
+
+struct hylang {
+	char name[NMLEN];	/* language name; empty for the default */
+	int init;		/* hyphenation data initialized */
+	/* exceptions (.hw) */
+	struct trie *hwtrie;	/* map words to hwhyph[] offsets; NULL if read-only */
+	char *hwhyph;		/* buffer for .hw hyphenations */
+	int hwhyph_len, hwhyph_sz;	/* used and allocated hwhyph[] length */
+	struct ptrie *hwpt;	/* read-only exceptions */
+	char *hwdat;		/* read-only exception hyphenations */
+	/* patterns */
+	struct trie *hytrie;	/* map patterns to hynums[] offsets; NULL if read-only */
+	char *hynums;		/* hyphenation pattern numbers */
+	int hynums_len, hynums_sz;	/* used and allocated hynums[] length */
+	struct ptrie *hypt;	/* read-only patterns */
+	char *hydat;		/* read-only pattern numbers */
+	/* .hcode mappings */
+	int *hcodepg[HCMAX >> 8];	/* code point pages; hcodedst[] index + 1 */
+	struct dict *hcodedict;		/* other characters to hcodedst[] indices */
+	char (*hcodesrc)[GNLEN];
+	char (*hcodedst)[GNLEN];
+	int hcode_n, hcode_sz;
+	struct hyfile *files;	/* mapped compiled files, unmapped by .hpf */
+};
 
-static char hwword[HYPATLEN];	/* buffer for .hw words */
-static char hwhyph[HYPATLEN];	/* buffer for .hw hyphenations */
-static int hwword_len;		/* used hwword[] length */
-static struct dict *hwdict;	/* map words to their index in hwoff[] */
-static int hwoff[NHYPHS];	/* the offset of words in hwword[] */
-static int hw_n;		/* the number of dictionary words */
+static struct hylang **langs;	/* hyphenation languages */
+static int langs_n, langs_sz;
+static struct hylang *hl;	/* the current language */
+
+/* select the hyphenation language of the current environment */
+static void hylang_sel(void)
+{
+	hl = langs[n_hla >= 0 && n_hla < langs_n ? n_hla : 0];
+}
+
+/* the hyphenation dictionary (.hw) */
 
 /* read a single character from s into d; return the number of characters read */
 static int hy_cget(char *d, char *s)
@@ -62,14 +107,59 @@ int hy_cput(char *d, char *s)
 	return strlen(d);
 }
 
-/* insert word s into hwword[] and hwhyph[] */
+/* insert word p with hyphenations h into hl->hwtrie and hl->hwhyph[] */
+static void hw_put(char *p, char *h)
+{
+	int len = strlen(p) + 1;
+	if (len < 3 || trie_get(hl->hwtrie, p) >= 0)	/* the first entry wins */
+		return;
+	/* hw_lookup() may read up to WORDLEN bytes from an entry */
+	if (hl->hwhyph_len + len + WORDLEN > hl->hwhyph_sz) {
+		int sz = hl->hwhyph_sz;
+		hl->hwhyph_sz = MAX(sz * 2, hl->hwhyph_len + len + WORDLEN + 4096);
+		hl->hwhyph = mextend(hl->hwhyph, sz, hl->hwhyph_sz, 1);
+	}
+	memcpy(hl->hwhyph + hl->hwhyph_len, h, len);
+	trie_put(hl->hwtrie, p, hl->hwhyph_len);
+	hl->hwhyph_len += len;
+}
+
+/* insert the exceptions of a read-only table in their original order */
+static void hw_merge(struct ptrie *pt, char *dat)
+{
+	char word[WORDLEN];
+	int *slot;
+	int n = 0;
+	int i;
+	for (i = 0; i < pt->n; i++)
+		n = MAX(n, pt->val[i] + 1);
+	slot = xmalloc((n + 1) * sizeof(slot[0]));
+	memset(slot, 0xff, (n + 1) * sizeof(slot[0]));
+	for (i = 0; i < pt->n; i++)
+		if (pt->val[i] >= 0)
+			slot[pt->val[i]] = i;
+	for (i = 0; i < n; i++)
+		if (slot[i] >= 0 && !ptrie_key(pt, slot[i], word, sizeof(word)))
+			hw_put(word, dat + i);
+	free(slot);
+}
+
+/* copy the read-only exceptions before modifying them */
+static void hw_copy(void)
+{
+	hl->hwtrie = trie_make();
+	hl->hwhyph_len = 0;
+	hw_merge(hl->hwpt, hl->hwdat);
+}
+
+/* insert word s into hl->hwtrie and hl->hwhyph[] */
 static void hw_add(char *s)
 {
-	char *p = hwword + hwword_len;
-	char *n = hwhyph + hwword_len;
+	char p[WORDLEN];
+	char n[WORDLEN];
 	int len = strlen(s) + 1;
 	int i = 0, c;
-	if (hw_n == NHYPHS || hwword_len + len > sizeof(hwword))
+	if (len > WORDLEN)
 		return;
 	memset(n, 0, len);
 	while ((c = (unsigned char) *s++)) {
@@ -79,10 +169,30 @@ static void hw_add(char *s)
 			p[i++] = c;
 	}
 	p[i] = '\0';
-	hwoff[hw_n] = hwword_len;
-	dict_put(hwdict, hwword + hwoff[hw_n], hw_n);
-	hwword_len += i + 1;
-	hw_n++;
+	if (!hl->hwtrie)
+		hw_copy();
+	hw_put(p, n);
+}
+
+/* append the exceptions of a read-only table */
+static void hw_load(struct ptrie *pt, char *dat)
+{
+	if (hl->hwtrie && !hl->hwhyph_len) {	/* no exceptions; use pt directly */
+		trie_free(hl->hwtrie);
+		hl->hwtrie = NULL;
+		hl->hwpt = pt;
+		hl->hwdat = dat;
+	} else if (hl->hwtrie || hl->hwpt != pt) {
+		if (!hl->hwtrie)
+			hw_copy();
+		hw_merge(pt, dat);
+	}
+}
+
+/* load english exceptions */
+static void hw_en(void)
+{
+	hw_load(&en_hwtrie, en_hwhyph);
 }
 
 static int hw_lookup(char *word, char *hyph)
@@ -90,15 +200,21 @@ static int hw_lookup(char *word, char *hyph)
 	char word2[WORDLEN] = {0};
 	char *hyph2;
 	int map[WORDLEN] = {0};
+	int idx[WORDLEN];
 	int off = 0;
-	int i, j, idx = -1;
+	int i = -1, j, n;
 	hcode_strcpy(word2, word, map, 0);
 	while (word2[off] == '.')	/* skip unknown characters at the front */
 		off++;
-	i = dict_prefix(hwdict, word2 + off, &idx);
+	/* the earliest .hw word that is a prefix of word2 */
+	n = ptrie_prefix(hl->hwtrie ? trie_pack(hl->hwtrie) : hl->hwpt,
+			word2 + off, idx, LEN(idx));
+	for (j = 0; j < n; j++)
+		if (i < 0 || idx[j] < i)
+			i = idx[j];
 	if (i < 0)
 		return 1;
-	hyph2 = hwhyph + hwoff[i];
+	hyph2 = (hl->hwtrie ? hl->hwhyph : hl->hwdat) + i;
 	for (j = 0; word2[j + off]; j++)
 		if (hyph2[j])
 			hyph[map[j + off]] = hyph2[j];
@@ -110,6 +226,7 @@ void tr_hw(char **args)
 	char word[WORDLEN];
 	char *c;
 	int i;
+	hylang_sel();
 	for (i = 1; i < NARGS && args[i]; i++) {
 		char *s = args[i];
 		char *d = word;
@@ -120,30 +237,21 @@ void tr_hw(char **args)
 		}
 		hw_add(word);
 	}
+	hcache_clear();
 }
 
 /* the tex hyphenation algorithm */
 
-static int hyinit;		/* hyphenation data initialized */
-static char hypats[HYPATLEN];	/* hyphenation patterns */
-static char hynums[HYPATLEN];	/* hyphenation pattern numbers */
-static int hypats_len;		/* used hypats[] and hynums[] length */
-static struct dict *hydict;	/* map patterns to their index in hyoff[] */
-static int hyoff[NHYPHS];	/* the offset of this pattern in hypats[] */
-static int hy_n;		/* the number of patterns */
-
 /* find the patterns matching s and update hyphenation values in n */
-static void hy_find(char *s, char *n)
-{
-	int plen;
-	char *p, *np;
-	int i, j;
-	int idx = -1;
-	while ((i = dict_prefix(hydict, s, &idx)) >= 0) {
-		p = hypats + hyoff[i];
-		np = hynums + (p - hypats);
-		plen = strlen(p) + 1;
-		for (j = 0; j < plen; j++)
+static void hy_find(struct ptrie *pt, char *nums, char *s, char *n)
+{
+	int pats[WORDLEN];
+	char *np;
+	int i, j, cnt;
+	cnt = ptrie_prefix(pt, s, pats, LEN(pats));
+	for (i = 0; i < cnt; i++) {
+		np = nums + pats[i];
+		for (j = 0; np[j] != HYEND; j++)
 			if (n[j] < np[j])
 				n[j] = np[j];
 	}
@@ -157,6 +265,8 @@ static void hy_dohyph(char *hyph, char *word, int flg)
 	int c[WORDLEN];			/* start of the i-th character in w */
 	int wmap[WORDLEN] = {0};	/* w[i] corresponds to word[wmap[i]] */
 	char ch[GNLEN];
+	struct ptrie *pt = hl->hytrie ? trie_pack(hl->hytrie) : hl->hypt;
+	char *nums = hl->hytrie ? hl->hynums : hl->hydat;
 	int nc = 0;
 	int i, wlen;
 	hcode_strcpy(w, word, wmap, 1);
@@ -164,7 +274,7 @@ static void hy_dohyph(char *hyph, char *word, int flg)
 	for (i = 0; i < wlen - 1; i += hy_cget(ch, w + i))
 		c[nc++] = i;
 	for (i = 0; i < nc - 1; i++)
-		hy_find(w + c[i], n + c[i]);
+		hy_find(pt, nums, w + c[i], n + c[i]);
 	memset(hyph, 0, wlen * sizeof(hyph[0]));
 	for (i = 3; i < nc - 2; i++)
 		if (n[c[i]] % 2 && w[c[i - 1]] != '.' && w[c[i]] != '.' &&
@@ -174,14 +284,54 @@ static void hy_dohyph(char *hyph, char *word, int flg)
 			hyph[wmap[c[i]]] = 1;
 }
 
-/* insert pattern s into hypats[] and hynums[] */
+/* insert pattern p with numbers n into hl->hytrie and hl->hynums[] */
+static void hy_put(char *p, char *n)
+{
+	int i = strlen(p);
+	int j, old;
+	if ((old = trie_get(hl->hytrie, p)) >= 0) {	/* merge repeated patterns */
+		for (j = 0; j <= i; j++)
+			if (hl->hynums[old + j] < n[j])
+				hl->hynums[old + j] = n[j];
+		return;
+	}
+	if (hl->hynums_len + i + 2 > hl->hynums_sz) {
+		int sz = hl->hynums_sz;
+		hl->hynums_sz = MAX(sz * 2, hl->hynums_len + i + 2 + 4096);
+		hl->hynums = mextend(hl->hynums, sz, hl->hynums_sz, 1);
+	}
+	memcpy(hl->hynums + hl->hynums_len, n, i + 1);
+	hl->hynums[hl->hynums_len + i + 1] = HYEND;
+	trie_put(hl->hytrie, p, hl->hynums_len);
+	hl->hynums_len += i + 2;
+}
+
+/* insert the patterns of a read-only table */
+static void hy_merge(struct ptrie *pt, char *nums)
+{
+	char pat[WORDLEN];
+	int i;
+	for (i = 0; i < pt->n; i++)
+		if (pt->val[i] >= 0 && !ptrie_key(pt, i, pat, sizeof(pat)))
+			hy_put(pat, nums + pt->val[i]);
+}
+
+/* copy the read-only patterns before modifying them */
+static void hy_copy(void)
+{
+	hl->hytrie = trie_make();
+	hl->hynums_len = 0;
+	hy_merge(hl->hypt, hl->hydat);
+}
+
+/* insert pattern s into hl->hytrie and hl->hynums[] */
 static void hy_add(char *s)
 {
-	char *p = hypats + hypats_len;
-	char *n = hynums + hypats_len;
+	char p[WORDLEN];
+	char n[WORDLEN];
 	int len = strlen(s) + 1;
 	int i = 0, c;
-	if (hy_n >= NHYPHS || hypats_len + len >= sizeof(hypats))
+	if (len > WORDLEN)
 		return;
 	memset(n, 0, len);
 	while ((c = (unsigned char) *s++)) {
@@ -191,24 +341,74 @@ static void hy_add(char *s)
 			p[i++] = c;
 	}
 	p[i] = '\0';
-	hyoff[hy_n] = hypats_len;
-	dict_put(hydict, hypats + hyoff[hy_n], hy_n);
-	hypats_len += i + 1;
-	hy_n++;
+	if (!hl->hytrie)
+		hy_copy();
+	hy_put(p, n);
+}
+
+/* append the patterns of a read-only table */
+static void hy_load(struct ptrie *pt, char *nums)
+{
+	if (hl->hytrie && !hl->hynums_len) {	/* no patterns; use pt directly */
+		trie_free(hl->hytrie);
+		hl->hytrie = NULL;
+		hl->hypt = pt;
+		hl->hydat = nums;
+	} else if (hl->hytrie || hl->hypt != pt) {
+		if (!hl->hytrie)
+			hy_copy();
+		hy_merge(pt, nums);
+	}
+}
+
+/* load english patterns */
+static void hy_en(void)
+{
+	hy_load(&en_hytrie, en_hynums);
 }
 
 /* .hcode request */
-static struct dict *hcodedict;
-static char hcodesrc[NHCODES][GNLEN];
-static char hcodedst[NHCODES][GNLEN];
-static int hcode_n;
+
+/* decode the utf-8 character of length l at s; -1 if not in page tables */
+static int hcode_cp(char *s, int l)
+{
+	int c = (unsigned char) s[0];
+	int i;
+	if (l == 1)
+		return c < 0x80 ? c : -1;
+	c &= 0x7f >> l;
+	for (i = 1; i < l; i++)
+		c = (c << 6) | ((unsigned char) s[i] & 0x3f);
+	return c < HCMAX ? c : -1;
+}
+
+/* the code point of character s or -1 if it is not a single code point */
+static int hcode_key(char *s)
+{
+	int l = utf8len((unsigned char) s[0]);
+	return l && !s[l] ? hcode_cp(s, l) : -1;
+}
+
+/* the hcodedst[] index of the mapping for code point c or -1 */
+static int hcode_pget(int c)
+{
+	int *pg = hl->hcodepg[c >> 8];
+	return pg ? pg[c & 0xff] - 1 : -1;
+}
+
+/* the hcodedst[] index of the mapping for character s or -1 */
+static int hcode_get(char *s)
+{
+	int c = hcode_key(s);
+	return c >= 0 ? hcode_pget(c) : dict_get(hl->hcodedict, s);
+}
 
 /* replace the character in s after .hcode mapping; returns s's new length */
 static int hcode_mapchar(char *s)
 {
-	int i = dict_get(hcodedict, s);
+	int i = hcode_get(s);
 	if (i >= 0)
-		strcpy(s, hcodedst[i]);
+		strcpy(s, hl->hcodedst[i]);
 	else if (!s[1])
 		*s = isalpha((unsigned char) *s) ? tolower((unsigned char) *s) : '.';
 	return strlen(s);
@@ -222,10 +422,25 @@ static void hcode_strcpy(char *d, char *s, int *map, int dots)
 	if (dots)
 		d[di++] = '.';
 	while (di < WORDLEN - GNLEN && s[si]) {
+		int l = utf8len((unsigned char) s[si]);
+		int cp = s[si] != '\\' ? hcode_cp(s + si, l) : -1;
+		int i = cp >= 0 ? hcode_pget(cp) : -1;
 		map[di] = si;
-		si += hy_cget(c, s + si);
-		hcode_mapchar(c);
-		di += hy_cput(d + di, c);
+		if (cp >= 0 && i >= 0) {	/* mapped code points */
+			di += hy_cput(d + di, hl->hcodedst[i]);
+			si += l;
+		} else if (cp >= 0 && l == 1) {
+			d[di++] = isalpha(cp) ? tolower(cp) : '.';
+			si++;
+		} else if (cp >= 0) {
+			memcpy(d + di, s + si, l);
+			di += l;
+			si += l;
+		} else {
+			si += hy_cget(c, s + si);
+			hcode_mapchar(c);
+			di += hy_cput(d + di, c);
+		}
 	}
 	if (dots)
 		d[di++] = '.';
@@ -234,64 +449,135 @@ static void hcode_strcpy(char *d, char *s, int *map, int dots)
 
 static void hcode_add(char *c1, char *c2)
 {
-	int i = dict_get(hcodedict, c1);
+	int c = hcode_key(c1);
+	int i = hcode_get(c1);
 	if (i >= 0) {
-		strcpy(hcodedst[i], c2);
-	} else if (hcode_n < NHCODES) {
-		strcpy(hcodesrc[hcode_n], c1);
-		strcpy(hcodedst[hcode_n], c2);
-		dict_put(hcodedict, hcodesrc[hcode_n], hcode_n);
-		hcode_n++;
+		strcpy(hl->hcodedst[i], c2);
+		return;
+	}
+	if (hl->hcode_n == hl->hcode_sz) {
+		hl->hcode_sz = hl->hcode_sz + 128;
+		hl->hcodesrc = mextend(hl->hcodesrc, hl->hcode_n, hl->hcode_sz,
+				sizeof(hl->hcodesrc[0]));
+		hl->hcodedst = mextend(hl->hcodedst, hl->hcode_n, hl->hcode_sz,
+				sizeof(hl->hcodedst[0]));
+	}
+	strcpy(hl->hcodesrc[hl->hcode_n], c1);
+	strcpy(hl->hcodedst[hl->hcode_n], c2);
+	if (c >= 0) {
+		if (!hl->hcodepg[c >> 8]) {
+			hl->hcodepg[c >> 8] = xmalloc(256 * sizeof(int));
+			memset(hl->hcodepg[c >> 8], 0, 256 * sizeof(int));
+		}
+		hl->hcodepg[c >> 8][c & 0xff] = hl->hcode_n + 1;
+	} else {
+		dict_put(hl->hcodedict, c1, hl->hcode_n);
 	}
+	hl->hcode_n++;
 }
 
 void tr_hcode(char **args)
 {
 	char c1[GNLEN], c2[GNLEN];
 	char *s = args[1];
+	hylang_sel();
 	while (s && charread(&s, c1) >= 0 && charread(&s, c2) >= 0)
 		hcode_add(c1, c2);
+	hcache_clear();
 }
 
-static void hyph_readpatterns(char *s)
+/* the cache of hyphenated words */
+
+#define HCSIZE		8192	/* the default number of cache slots */
+
+struct hcent {
+	char *word;		/* the word followed by its hyphenation */
+	int sz;			/* the size of word[] */
+	int flg;		/* hyphenation flags */
+	int gen;		/* cache generation */
+	struct hylang *lang;	/* hyphenation language */
+};
+
+static struct hcent *hcache;	/* direct-mapped cache slots */
+static int hcache_n = HCSIZE;	/* the number of slots (.hycache) */
+static int hcache_gen = 1;	/* entries of other generations are invalid */
+static int hcache_hits, hcache_misses;
+
+/* invalidate cached words; called when hyphenation tables change */
+static void hcache_clear(void)
 {
-	char word[WORDLEN];
-	char *d;
-	while (*s) {
-		d = word;
-		while (*s && !isspace((unsigned char) *s))
-			*d++ = *s++;
-		*d = '\0';
-		hy_add(word);
-		while (*s && isspace((unsigned char) *s))
-			s++;
-	}
+	hcache_gen++;
 }
 
-static void hyph_readexceptions(char *s)
+static struct hcent *hcache_slot(char *word)
 {
-	char word[WORDLEN];
-	char *d;
-	while (*s) {
-		d = word;
-		while (*s && !isspace((unsigned char) *s))
-			*d++ = *s++;
-		*d = '\0';
-		hw_add(word);
-		while (*s && isspace((unsigned char) *s))
-			s++;
+	unsigned h = 2166136261u;
+	char *s = word;
+	if (!hcache_n)
+		return NULL;
+	if (!hcache) {
+		hcache = xmalloc(hcache_n * sizeof(hcache[0]));
+		memset(hcache, 0, hcache_n * sizeof(hcache[0]));
 	}
+	while (*s)
+		h = (h ^ (unsigned char) *s++) * 16777619u;
+	return &hcache[h % hcache_n];
 }
 
 void hyphenate(char *hyph, char *word, int flg)
 {
-	if (!hyinit) {
-		hyinit = 1;
-		hyph_readpatterns(en_patterns);
-		hyph_readexceptions(en_exceptions);
+	struct hcent *hc = hcache_slot(word);
+	int len = strlen(word);
+	hylang_sel();
+	if (hc && hc->gen == hcache_gen && hc->flg == flg &&
+			hc->lang == hl && !strcmp(hc->word, word)) {
+		memcpy(hyph, hc->word + len + 1, len);
+		hcache_hits++;
+		return;
+	}
+	if (!hl->init) {
+		hl->init = 1;
+		hy_en();
+		hw_en();
 	}
 	if (hw_lookup(word, hyph))
 		hy_dohyph(hyph, word, flg);
+	if (!hc)
+		return;
+	hcache_misses++;
+	if (hc->sz < 2 * (len + 1)) {
+		free(hc->word);
+		hc->sz = 2 * (len + 1);
+		hc->word = xmalloc(hc->sz);
+	}
+	memcpy(hc->word, word, len + 1);
+	memcpy(hc->word + len + 1, hyph, len);
+	hc->flg = flg;
+	hc->gen = hcache_gen;
+	hc->lang = hl;
+}
+
+/* return hyphenation cache statistics */
+void hyph_cstat(int *hits, int *misses)
+{
+	*hits = hcache_hits;
+	*misses = hcache_misses;
+}
+
+static void hcache_free(void)
+{
+	int i;
+	for (i = 0; hcache && i < hcache_n; i++)
+		free(hcache[i].word);
+	free(hcache);
+	hcache = NULL;
+}
+
+/* .hycache request: set the number of cache slots; zero disables it */
+void tr_hycache(char **args)
+{
+	hcache_free();
+	hcache_n = args[1] ? MAX(0, eval(args[1], '\0')) : HCSIZE;
 }
 
 /* lowercase-uppercase character mapping */
@@ -350,18 +636,236 @@ static char *hycase[][2] = {
 	{"ք", "Ք"}, {"օ", "Օ"},
 };
 
-void tr_hpfa(char **args)
+/*
+ * compiled hyphenation files
+ *
+ * The patterns, exceptions, and hcode mappings loaded by .hpf can be
+ * compiled into a file (neatroff -H), which is mapped and used directly
+ * when given as the first argument of .hpf or .hpfa.
+ */
+#define HI_MAGIC	"neathy2"
+
+struct hyimg {
+	char magic[8];		/* HI_MAGIC */
+	int hdrsz;		/* sizeof(struct hyimg) */
+	long size;		/* image size */
+	int hy_n, hw_n;		/* the number of pattern and exception trie slots */
+	int hcode_n;		/* the number of hcode mappings */
+	int hynums_len, hwhyph_len;	/* the length of hynums and hwhyph */
+	/* the offset of image sections */
+	int hy_base, hy_chk, hy_val;	/* pattern trie */
+	int hynums;		/* pattern numbers */
+	int hw_base, hw_chk, hw_val;	/* exception trie */
+	int hwhyph;		/* exception hyphenations */
+	int hcode;		/* hcode mappings; pairs of char[GNLEN] */
+};
+
+/* a mapped compiled hyphenation file */
+struct hyfile {
+	struct hyimg *img;
+	struct ptrie hy, hw;	/* the tries of the image */
+	struct hyfile *next;
+};
+
+/* append n bytes of d (zeros if NULL) to img at *len, aligned to 8 */
+static long hyimg_put(char *img, long *len, void *d, long n)
+{
+	long off = (*len + 7) & ~7l;
+	if (img && d)
+		memcpy(img + off, d, n);
+	*len = off + n;
+	return off;
+}
+
+/* lay out the current tables in img, if not NULL; return the image size */
+static long hyimg_fill(char *img)
+{
+	struct ptrie *hy = trie_pack(hl->hytrie);
+	struct ptrie *hw = trie_pack(hl->hwtrie);
+	struct hyimg hdr;
+	long len = sizeof(hdr);
+	int i;
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.hy_n = hy->n;
+	hdr.hy_base = hyimg_put(img, &len, hy->base, hy->n * sizeof(int));
+	hdr.hy_chk = hyimg_put(img, &len, hy->chk, hy->n * sizeof(int));
+	hdr.hy_val = hyimg_put(img, &len, hy->val, hy->n * sizeof(int));
+	hdr.hynums_len = hl->hynums_len;
+	hdr.hynums = hyimg_put(img, &len, hl->hynums, hl->hynums_len);
+	hdr.hw_n = hw->n;
+	hdr.hw_base = hyimg_put(img, &len, hw->base, hw->n * sizeof(int));
+	hdr.hw_chk = hyimg_put(img, &len, hw->chk, hw->n * sizeof(int));
+	hdr.hw_val = hyimg_put(img, &len, hw->val, hw->n * sizeof(int));
+	/* hw_lookup() may read up to WORDLEN bytes from an entry */
+	hdr.hwhyph_len = hl->hwhyph_len;
+	hdr.hwhyph = hyimg_put(img, &len, hl->hwhyph, hl->hwhyph_len);
+	hyimg_put(img, &len, NULL, WORDLEN);
+	hdr.hcode_n = hl->hcode_n;
+	hdr.hcode = hyimg_put(img, &len, NULL, hl->hcode_n * 2 * GNLEN);
+	for (i = 0; img && i < hl->hcode_n; i++) {
+		strcpy(img + hdr.hcode + (i * 2) * GNLEN, hl->hcodesrc[i]);
+		strcpy(img + hdr.hcode + (i * 2 + 1) * GNLEN, hl->hcodedst[i]);
+	}
+	memcpy(hdr.magic, HI_MAGIC, sizeof(hdr.magic));
+	hdr.hdrsz = sizeof(hdr);
+	hdr.size = len;
+	if (img)
+		memcpy(img, &hdr, sizeof(hdr));
+	return len;
+}
+
+/* the section of img at off of len bytes; NULL if outside the image */
+static void *hyimg_sec(struct hyimg *img, long off, long len)
+{
+	if (off < img->hdrsz || off % sizeof(int) || len < 0 ||
+			len > img->size - off)
+		return NULL;
+	return (char *) img + off;
+}
+
+/*
+ * check a trie of n slots in img; its values index dat of len bytes
+ * and, if nums is nonzero, are pattern numbers terminated with HYEND
+ */
+static int hyimg_badtrie(struct hyimg *img, int n, int base_off,
+		int chk_off, int val_off, char *dat, long len, int nums)
+{
+	int *base = hyimg_sec(img, base_off, n * (long) sizeof(int));
+	int *chk = hyimg_sec(img, chk_off, n * (long) sizeof(int));
+	int *val = hyimg_sec(img, val_off, n * (long) sizeof(int));
+	int *dep;
+	int i, p, d, bad = 0;
+	if (n < 1 || !base || !chk || !val || chk[0] != 0)
+		return 1;
+	for (i = 0; i < n; i++) {
+		if (base[i] < 0 || base[i] >= n || chk[i] < -1 || chk[i] >= n)
+			return 1;
+		if (chk[i] < 0 && val[i] != -1)
+			return 1;
+		if (chk[i] >= 0 && chk[chk[i]] < 0)
+			return 1;
+		if (i > 0 && chk[i] >= 0 && (i - base[chk[i]] < 1 ||
+				i - base[chk[i]] > 255))
+			return 1;
+		if (val[i] < -1 || val[i] >= len)
+			return 1;
+	}
+	/* the length of the key of each slot; parent links must reach the root */
+	dep = xmalloc(n * sizeof(dep[0]));
+	memset(dep, 0xff, n * sizeof(dep[0]));
+	dep[0] = 0;
+	for (i = 1; i < n && !bad; i++) {
+		if (chk[i] < 0)
+			continue;
+		for (p = i, d = 0; dep[p] < 0 && d < WORDLEN; p = chk[p])
+			d++;
+		if (dep[p] < 0 || dep[p] + d >= WORDLEN) {
+			bad = 1;
+			break;
+		}
+		d += dep[p];
+		for (p = i; dep[p] < 0; p = chk[p])
+			dep[p] = d--;
+	}
+	for (i = 0; i < n && !bad && nums; i++)
+		if (val[i] >= 0 && (val[i] + dep[i] + 2 > len ||
+				dat[val[i] + dep[i] + 1] != HYEND))
+			bad = 1;
+	free(dep);
+	return bad;
+}
+
+/* return nonzero if the sections of img are invalid */
+static int hyimg_bad(struct hyimg *img)
+{
+	char *hynums, *hwhyph, *hcode;
+	int i;
+	if (img->hynums_len < 0 || img->hwhyph_len < 0 || img->hcode_n < 0)
+		return 1;
+	hynums = hyimg_sec(img, img->hynums, img->hynums_len);
+	/* hw_lookup() may read up to WORDLEN bytes from an entry */
+	hwhyph = hyimg_sec(img, img->hwhyph, img->hwhyph_len + (long) WORDLEN);
+	hcode = hyimg_sec(img, img->hcode, img->hcode_n * 2l * GNLEN);
+	if (!hynums || !hwhyph || !hcode)
+		return 1;
+	if (hyimg_badtrie(img, img->hy_n, img->hy_base, img->hy_chk,
+			img->hy_val, hynums, img->hynums_len, 1))
+		return 1;
+	if (hyimg_badtrie(img, img->hw_n, img->hw_base, img->hw_chk,
+			img->hw_val, hwhyph, img->hwhyph_len, 0))
+		return 1;
+	for (i = 0; i < img->hcode_n * 2; i++)
+		if (!memchr(hcode + i * GNLEN, '\0', GNLEN))
+			return 1;
+	return 0;
+}
+
+/* map the compiled hyphenation file at path */
+static struct hyimg *hyimg_open(char *path)
+{
+	struct hyimg *img;
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(*img)) {
+		close(fd);
+		return NULL;
+	}
+	img = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (img == MAP_FAILED)
+		return NULL;
+	if (memcmp(img->magic, HI_MAGIC, sizeof(img->magic)) ||
+			img->hdrsz != sizeof(*img) || img->size != st.st_size ||
+			hyimg_bad(img)) {
+		munmap(img, st.st_size);
+		return NULL;
+	}
+	return img;
+}
+
+/* append the tables of a mapped image */
+static void hyimg_load(struct hyimg *img)
+{
+	struct hyfile *hf = xmalloc(sizeof(*hf));
+	char *buf = (void *) img;
+	char *hcode = buf + img->hcode;
+	int i;
+	hf->img = img;
+	hf->hy.base = (void *) (buf + img->hy_base);
+	hf->hy.chk = (void *) (buf + img->hy_chk);
+	hf->hy.val = (void *) (buf + img->hy_val);
+	hf->hy.n = img->hy_n;
+	hf->hw.base = (void *) (buf + img->hw_base);
+	hf->hw.chk = (void *) (buf + img->hw_chk);
+	hf->hw.val = (void *) (buf + img->hw_val);
+	hf->hw.n = img->hw_n;
+	hf->next = hl->files;
+	hl->files = hf;
+	hy_load(&hf->hy, buf + img->hynums);
+	hw_load(&hf->hw, buf + img->hwhyph);
+	for (i = 0; i < img->hcode_n; i++)
+		hcode_add(hcode + (i * 2) * GNLEN, hcode + (i * 2 + 1) * GNLEN);
+}
+
+/* load the hyphenation files of .hpfa arguments */
+static void hyph_load(char **args)
 {
 	char tok[128], c1[GNLEN], c2[GNLEN];
+	struct hyimg *img;
 	FILE *filp;
-	hyinit = 1;
+	hl->init = 1;
+	hcache_clear();
 	/* load english hyphenation patterns with no arguments */
 	if (!args[1]) {
-		hyph_readpatterns(en_patterns);
-		hyph_readexceptions(en_exceptions);
+		hy_en();
+		hw_en();
 	}
 	/* reading patterns */
-	if (args[1] && (filp = fopen(args[1], "r"))) {
+	if (args[1] && (img = hyimg_open(args[1]))) {
+		hyimg_load(img);
+	} else if (args[1] && (filp = fopen(args[1], "r"))) {
 		while (fscanf(filp, "%128s", tok) == 1)
 			if (strlen(tok) < WORDLEN)
 				hy_add(tok);
@@ -391,37 +895,136 @@ void tr_hpfa(char **args)
 	}
 }
 
-void hyph_init(void)
+static struct hylang *hylang_make(char *name)
 {
-	hwdict = dict_make(-1, 0, 2);
-	hydict = dict_make(-1, 0, 2);
-	hcodedict = dict_make(-1, 0, 1);
+	struct hylang *l = xmalloc(sizeof(*l));
+	memset(l, 0, sizeof(*l));
+	snprintf(l->name, sizeof(l->name), "%s", name);
+	l->hwtrie = trie_make();
+	l->hwpt = &en_hwtrie;
+	l->hwdat = en_hwhyph;
+	l->hytrie = trie_make();
+	l->hypt = &en_hytrie;
+	l->hydat = en_hynums;
+	l->hcodedict = dict_make(-1, 1);
+	return l;
 }
 
-void hyph_done(void)
+static void hylang_free(struct hylang *l)
 {
-	if (hwdict)
-		dict_free(hwdict);
-	if (hydict)
-		dict_free(hydict);
-	if (hcodedict)
-		dict_free(hcodedict);
+	int i;
+	while (l->files) {
+		struct hyfile *hf = l->files;
+		l->files = hf->next;
+		munmap(hf->img, hf->img->size);
+		free(hf);
+	}
+	if (l->hwtrie)
+		trie_free(l->hwtrie);
+	if (l->hytrie)
+		trie_free(l->hytrie);
+	dict_free(l->hcodedict);
+	for (i = 0; i < LEN(l->hcodepg); i++)
+		free(l->hcodepg[i]);
+	free(l->hwhyph);
+	free(l->hynums);
+	free(l->hcodesrc);
+	free(l->hcodedst);
+	free(l);
+}
+
+void tr_hpfa(char **args)
+{
+	hylang_sel();
+	hyph_load(args);
 }
 
 void tr_hpf(char **args)
 {
-	/* reseting the patterns */
-	hypats_len = 0;
-	hy_n = 0;
-	dict_free(hydict);
-	/* reseting the dictionary */
-	hwword_len = 0;
-	hw_n = 0;
-	dict_free(hwdict);
-	/* reseting hcode mappings */
-	hcode_n = 0;
-	dict_free(hcodedict);
+	int i;
+	hylang_sel();
+	for (i = 0; langs[i] != hl; i++)
+		;
+	/* reseting the patterns, the dictionary, and hcode mappings */
+	langs[i] = hylang_make(hl->name);
+	hylang_free(hl);
+	hl = langs[i];
 	/* reading */
+	hyph_load(args);
+}
+
+/* .hla request: select the hyphenation language of the environment */
+void tr_hla(char **args)
+{
+	char *name = args[1] ? args[1] : "";
+	int i;
+	for (i = 0; i < langs_n; i++)
+		if (!strcmp(name, langs[i]->name))
+			break;
+	if (i == langs_n) {
+		if (langs_n == langs_sz) {
+			langs_sz = langs_sz + 16;
+			langs = mextend(langs, langs_n, langs_sz, sizeof(langs[0]));
+		}
+		langs[langs_n++] = hylang_make(name);
+	}
+	n_hla = i;
+}
+
+/* the name of hyphenation language id */
+char *hyph_lang(int id)
+{
+	return id >= 0 && id < langs_n ? langs[id]->name : "";
+}
+
+void hyph_init(void)
+{
+	langs_sz = 16;
+	langs = mextend(NULL, 0, langs_sz, sizeof(langs[0]));
+	langs[langs_n++] = hylang_make("");
+	hl = langs[0];
+}
+
+void hyph_done(void)
+{
+	int i;
+	hcache_free();
+	for (i = 0; i < langs_n; i++)
+		hylang_free(langs[i]);
+	free(langs);
+	langs = NULL;
+	langs_n = 0;
+	langs_sz = 0;
+}
+
+/* compile the hyphenation files given as .hpf arguments into path */
+int hyph_compile(char *path, char **files, int n)
+{
+	char *args[NARGS] = {"hpf"};
+	char *img;
+	FILE *filp;
+	long len;
+	int i, ret = 0;
+	for (i = 0; i < n && i < 3; i++)
+		args[i + 1] = files[i];
 	hyph_init();
-	tr_hpfa(args);
+	hyph_load(args);
+	if (!hl->hytrie)
+		hy_copy();
+	if (!hl->hwtrie)
+		hw_copy();
+	len = hyimg_fill(NULL);
+	img = xmalloc(len);
+	memset(img, 0, len);
+	hyimg_fill(img);
+	filp = fopen(path, "w");
+	if (!filp || fwrite(img, 1, len, filp) != (size_t) len) {
+		errmsg("neatroff: cannot write %s\n", path);
+		ret = 1;
+	}
+	if (filp && fclose(filp))
+		ret = 1;
+	free(img);
+	hyph_done();
+	return ret;
 }
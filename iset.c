@@ -12,6 +12,8 @@ struct iset {
 	int *sz;
 	int *len;
 	int cnt;
+	int *off;	/* frozen sets: the offset of each set in ent[] */
+	int *ent;	/* frozen sets: -1-terminated entries */
 };
 
 static void iset_extend(struct iset *iset, int cnt)
@@ -33,27 +35,83 @@ struct iset *iset_make(void)
 void iset_free(struct iset *iset)
 {
 	int i;
-	for (i = 0; i < iset->cnt; i++)
-		free(iset->set[i]);
+	if (iset->set)
+		for (i = 0; i < iset->cnt; i++)
+			free(iset->set[i]);
 	free(iset->set);
 	free(iset->len);
 	free(iset->sz);
+	free(iset->off);
+	free(iset->ent);
 	free(iset);
 }
 
+/*
+ * compact the sets into a single array of entries (CSR layout)
+ *
+ * The set of key is stored in ent[off[key]...off[key + 1] - 1],
+ * including its terminating -1; empty sets occupy no entries.
+ * No more entries can be inserted into a frozen iset.
+ */
+void iset_freeze(struct iset *iset)
+{
+	int cnt = 0, n = 0;
+	int i;
+	if (iset->off)
+		return;
+	for (i = 0; i < iset->cnt; i++) {
+		if (iset->len[i]) {
+			cnt = i + 1;
+			n += iset->len[i] + 1;
+		}
+	}
+	iset->off = xmalloc((cnt + 1) * sizeof(iset->off[0]));
+	iset->ent = xmalloc(MAX(1, n) * sizeof(iset->ent[0]));
+	n = 0;
+	for (i = 0; i < cnt; i++) {
+		iset->off[i] = n;
+		if (iset->len[i]) {
+			memcpy(iset->ent + n, iset->set[i],
+				(iset->len[i] + 1) * sizeof(iset->ent[0]));
+			n += iset->len[i] + 1;
+		}
+		free(iset->set[i]);
+	}
+	iset->off[cnt] = n;
+	for (; i < iset->cnt; i++)
+		free(iset->set[i]);
+	free(iset->set);
+	free(iset->sz);
+	free(iset->len);
+	iset->set = NULL;
+	iset->sz = NULL;
+	iset->len = NULL;
+	iset->cnt = cnt;
+}
+
 int *iset_get(struct iset *iset, int key)
 {
-	return key >= 0 && key < iset->cnt ? iset->set[key] : NULL;
+	if (key < 0 || key >= iset->cnt)
+		return NULL;
+	if (iset->off)
+		return iset->off[key] < iset->off[key + 1] ?
+			iset->ent + iset->off[key] : NULL;
+	return iset->set[key];
 }
 
 int iset_len(struct iset *iset, int key)
 {
-	return key >= 0 && key < iset->cnt ? iset->len[key] : 0;
+	if (key < 0 || key >= iset->cnt)
+		return 0;
+	if (iset->off)
+		return iset->off[key] < iset->off[key + 1] ?
+			iset->off[key + 1] - iset->off[key] - 1 : 0;
+	return iset->len[key];
 }
 
 void iset_put(struct iset *iset, int key, int ent)
 {
-	if (key < 0 || key >= CNTMAX)
+	if (key < 0 || key >= CNTMAX || iset->off)
 		return;
 	if (key >= iset->cnt)
 		iset_extend(iset, ALIGN(key + 1, CNTMIN));
@@ -76,11 +134,9 @@ void iset_put(struct iset *iset, int key, int ent)
 /* check entry membership */
 int iset_has(struct iset *iset, int key, int ent)
 {
-	int i;
-	if (key < 0 || key >= iset->cnt || iset->len[key] == 0)
-		return 0;
-	for (i = 0; i < iset->len[key]; i++)
-		if (iset->set[key][i] == ent)
+	int *r = iset_get(iset, key);
+	while (r && *r >= 0)
+		if (*r++ == ent)
 			return 1;
 	return 0;
 }
@@ -3,27 +3,45 @@
 #include <string.h>
 #include "roff.h"
 
-#define MAPBEG		256	/* the entries reserved for .x names */
-
 /* register, macro, or environments names */
 static struct dict *mapdict;
 
-/* map register names to [0..NREGS] */
+/* builtin registers interned at MAP_xyz indices (in the same order) */
+static char *map_builtin[] = {
+	".it", ".itn", "lsn", ".nI", ".nm", ".nM", ".nn", ".nS", ".mc", ".mcn",
+	"ct", ".td", ".cd", "dl", "dn", "ln", "nl", "sb", "st", "%", ".b0",
+	".ce", ".f0", ".lg", ".hy", ".hycost", ".hycost2", ".hycost3", ".hlm",
+	".hla", ".i0", ".ti", ".kn", ".tI", ".I0", ".l0", ".L0", ".m0", ".mk",
+	".na", ".ns", ".o0", ".pmll", ".pmllcost", ".ss", ".sss", ".ssh",
+	".s0", ".sv", ".lt", ".lt0", ".v0", "bbllx", "bblly", "bburx", "bbury",
+};
+
+static void map_init(void)
+{
+	int i;
+	mapdict = dict_make(-1, 1);
+	for (i = 0; i < LEN(map_builtin); i++)
+		dict_put(mapdict, map_builtin[i], 0);
+	reg_grow(MAP_END);
+	if (MAPBEG + LEN(map_builtin) + 1 != MAP_END)
+		errdie("neatroff: map_builtin[] and MAP_xyz mismatch\n");
+}
+
+/* map register names to indices; the register tables grow to fit them */
 int map(char *s)
 {
 	int i;
+	if (!mapdict)
+		map_init();
 	if (!s[0])
 		return 0;
 	if (s[0] == '.' && s[1] && !s[2])	/* ".x" is mapped to 'x' */
 		return (unsigned char) s[1];
-	if (!mapdict)
-		mapdict = dict_make(-1, 1, 2);
 	i = dict_idx(mapdict, s);
 	if (i < 0) {
 		dict_put(mapdict, s, 0);
 		i = dict_idx(mapdict, s);
-		if (MAPBEG + i >= NREGS)
-			errdie("neatroff: increase NREGS\n");
+		reg_grow(MAPBEG + i + 1);
 	}
 	return MAPBEG + i;
 }
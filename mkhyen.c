@@ -0,0 +1,130 @@
+/*
+ * compile the english hyphenation patterns and exceptions of hyen.h
+ *
+ * The tables written to the standard output are included in hyph.c
+ * as hyenc.h; they follow the layout of hy_add() and hw_add().
+ */
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roff.h"
+#include "hyen.h"
+
+#define HYEND		10	/* terminates the numbers of a pattern */
+
+static char nums[1 << 20];	/* pattern numbers */
+static int nums_len;
+static char hyph[1 << 20];	/* exception hyphenations */
+static int hyph_len;
+
+/* read the next space-separated token of *s into d */
+static int readtok(char **s, char *d)
+{
+	char *beg;
+	while (isspace((unsigned char) **s))
+		(*s)++;
+	beg = *s;
+	while (**s && !isspace((unsigned char) **s) && *s - beg < WORDLEN - 1)
+		*d++ = *(*s)++;
+	*d = '\0';
+	return *s == beg;
+}
+
+static void hy_add(struct trie *t, char *s)
+{
+	char p[WORDLEN];
+	char *n = nums + nums_len;
+	int i = 0, j, c, old;
+	memset(n, 0, strlen(s) + 1);
+	while ((c = (unsigned char) *s++)) {
+		if (c >= '0' && c <= '9')
+			n[i] = c - '0';
+		else
+			p[i++] = c;
+	}
+	p[i] = '\0';
+	if ((old = trie_get(t, p)) >= 0) {
+		for (j = 0; j <= i; j++)
+			if (nums[old + j] < n[j])
+				nums[old + j] = n[j];
+		return;
+	}
+	n[i + 1] = HYEND;
+	trie_put(t, p, nums_len);
+	nums_len += i + 2;
+}
+
+static void hw_add(struct trie *t, char *s)
+{
+	char p[WORDLEN];
+	char *n = hyph + hyph_len;
+	int i = 0, c;
+	memset(n, 0, strlen(s) + 1);
+	while ((c = (unsigned char) *s++)) {
+		if (c == '-')
+			n[i] = 1;
+		else
+			p[i++] = c;
+	}
+	p[i] = '\0';
+	if (i < 2 || trie_get(t, p) >= 0)
+		return;
+	trie_put(t, p, hyph_len);
+	hyph_len += i + 1;
+}
+
+static void putints(char *name, int *a, int n)
+{
+	int i;
+	printf("static int %s[] = {", name);
+	for (i = 0; i < n; i++)
+		printf("%s%d,", i % 12 ? " " : "\n\t", a[i]);
+	printf("\n};\n\n");
+}
+
+static void putchars(char *name, char *a, int n)
+{
+	int i;
+	printf("static char %s[] = {", name);
+	for (i = 0; i < n; i++)
+		printf("%s%d,", i % 16 ? " " : "\n\t", a[i]);
+	printf("\n};\n\n");
+}
+
+static void puttrie(char *name, struct trie *t)
+{
+	struct ptrie *pt = trie_pack(t);
+	char buf[64];
+	sprintf(buf, "%s_base", name);
+	putints(buf, pt->base, pt->n);
+	sprintf(buf, "%s_chk", name);
+	putints(buf, pt->chk, pt->n);
+	sprintf(buf, "%s_val", name);
+	putints(buf, pt->val, pt->n);
+	printf("static struct ptrie %s = {\n", name);
+	printf("\t%s_base, %s_chk, %s_val, %d,\n};\n\n", name, name, name, pt->n);
+}
+
+int main(void)
+{
+	struct trie *hy = trie_make();
+	struct trie *hw = trie_make();
+	char tok[WORDLEN];
+	char *s;
+	s = en_patterns;
+	while (!readtok(&s, tok))
+		hy_add(hy, tok);
+	s = en_exceptions;
+	while (!readtok(&s, tok))
+		hw_add(hw, tok);
+	printf("/* english hyphenation tables; generated by mkhyen from hyen.h */\n\n");
+	puttrie("en_hytrie", hy);
+	putchars("en_hynums", nums, nums_len);
+	puttrie("en_hwtrie", hw);
+	/* hw_lookup() may read up to WORDLEN bytes from an entry */
+	putchars("en_hwhyph", hyph, hyph_len + WORDLEN);
+	trie_free(hy);
+	trie_free(hw);
+	return 0;
+}
@@ -142,7 +142,7 @@ static void outc(char *c)
 	int cwid, bwid;
 	if (!g)
 		return;
-	cwid = font_gwid(g->font, dev_font(o_f), o_s, g->wid);
+	cwid = font_glwid(g, dev_font(o_f), o_s);
 	bwid = font_wid(g->font, o_s, g->wid);
 	if (font_mapped(g->font, c))
 		c = g->name;
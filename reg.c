@@ -22,15 +22,16 @@ struct env {
 	char mc[GNLEN];		/* margin character (.mc) */
 };
 
-static int nregs[NREGS];	/* global number registers */
-static int nregs_inc[NREGS];	/* number register auto-increment size */
-static int nregs_fmt[NREGS];	/* number register format */
-static char *sregs[NREGS];	/* global string registers */
-static void *sregs_dat[NREGS];	/* builtin function data */
-static struct env *envs[NREGS];/* environments */
+static int *nregs;		/* global number registers */
+static int *nregs_inc;		/* number register auto-increment size */
+static int *nregs_fmt;		/* number register format */
+static char **sregs;		/* global string registers */
+static void **sregs_dat;	/* builtin function data */
+static struct env **envs;	/* environments */
 static struct env *env;		/* current enviroment */
 static int env_id;		/* current environment id */
-static int eregs_idx[NREGS];	/* register environment index in eregs[] */
+static int *eregs_idx;		/* register environment index in eregs[] */
+static int regs_sz;		/* the size of the arrays above */
 
 static char *eregs[] = {	/* environment-specific number registers */
 	"ln", ".f", ".i", ".j", ".l",
@@ -38,12 +39,28 @@ static char *eregs[] = {	/* environment-specific number registers */
 	".nS", ".m", ".s", ".u", ".v",
 	".it", ".itn", ".mc", ".mcn",
 	".ce", ".f0", ".i0", ".l0",
-	".hy", ".hycost", ".hycost2", ".hycost3", ".hlm",
+	".hy", ".hycost", ".hycost2", ".hycost3", ".hlm", ".hla",
 	".L0", ".m0", ".n0", ".s0", ".ss", ".ssh", ".sss", ".pmll", ".pmllcost",
 	".ti", ".lt", ".lt0", ".v0",
 	".I", ".I0", ".tI", ".td", ".cd",
 };
 
+/* make room for registers [0, n); called by map() for new names */
+void reg_grow(int n)
+{
+	int sz = regs_sz;
+	if (n <= sz)
+		return;
+	regs_sz = MAX(n, sz ? sz * 2 : MAPBEG + 1024);
+	nregs = mextend(nregs, sz, regs_sz, sizeof(nregs[0]));
+	nregs_inc = mextend(nregs_inc, sz, regs_sz, sizeof(nregs_inc[0]));
+	nregs_fmt = mextend(nregs_fmt, sz, regs_sz, sizeof(nregs_fmt[0]));
+	sregs = mextend(sregs, sz, regs_sz, sizeof(sregs[0]));
+	sregs_dat = mextend(sregs_dat, sz, regs_sz, sizeof(sregs_dat[0]));
+	envs = mextend(envs, sz, regs_sz, sizeof(envs[0]));
+	eregs_idx = mextend(eregs_idx, sz, regs_sz, sizeof(eregs_idx[0]));
+}
+
 /* return the address of a number register */
 int *nreg(int id)
 {
@@ -122,6 +139,8 @@ char *num_str(int id)
 		return "1";
 	if (s[0] == '.' && s[1] == 'e' && s[2] == 'v' && !s[3])
 		return map_name(env_id);
+	if (s[0] == '.' && !strcmp(".hla", s))
+		return hyph_lang(n_hla);
 	if (s[0] == '$' && s[1] == '$' && !s[2]) {
 		sprintf(numbuf, "%d", getpid());
 		return numbuf;
@@ -132,6 +151,18 @@ char *num_str(int id)
 	}
 	if (s[0] == '.' && !strcmp(".tabs", s))
 		return num_tabs();
+	if (s[0] == '.' && (!strcmp(".lch", s) || !strcmp(".lcm", s))) {
+		int hits, misses;
+		font_lcstat(&hits, &misses);
+		sprintf(numbuf, "%d", s[3] == 'h' ? hits : misses);
+		return numbuf;
+	}
+	if (s[0] == '.' && (!strcmp(".hych", s) || !strcmp(".hycm", s))) {
+		int hits, misses;
+		hyph_cstat(&hits, &misses);
+		sprintf(numbuf, "%d", s[4] == 'h' ? hits : misses);
+		return numbuf;
+	}
 	if (!nregs_fmt[id] || num_fmt(numbuf, *nreg(id), nregs_fmt[id]))
 		sprintf(numbuf, "%d", *nreg(id));
 	return numbuf;
@@ -290,11 +321,18 @@ void env_init(void)
 void env_done(void)
 {
 	int i;
-	for (i = 0; i < LEN(envs); i++)
+	for (i = 0; i < regs_sz; i++)
 		if (envs[i])
 			env_free(envs[i]);
-	for (i = 0; i < LEN(sregs); i++)
+	for (i = 0; i < regs_sz; i++)
 		free(sregs[i]);
+	free(nregs);
+	free(nregs_inc);
+	free(nregs_fmt);
+	free(sregs);
+	free(sregs_dat);
+	free(envs);
+	free(eregs_idx);
 }
 
 static int oenv[NPREV];		/* environment stack */
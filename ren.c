@@ -284,7 +284,7 @@ static void ren_dir(struct sbuf *sbuf)
 static int zwid(void)
 {
 	struct glyph *g = dev_glyph("0", n_f);
-	return g ? font_gwid(g->font, dev_font(n_f), n_s, g->wid) : 0;
+	return g ? font_glwid(g, dev_font(n_f), n_s) : 0;
 }
 
 /* append the line number to the output line */
@@ -916,7 +916,7 @@ void ren_tl(int (*next)(void), void (*back)(int))
 	char *pgnum;
 	char delim[GNLEN];
 	ren_first();
-	pgnum = num_str(map("%"));
+	pgnum = num_str(MAP_pg);
 	wb_init(&wb);
 	wb_init(&wb2);
 	charnext(delim, next, back);
@@ -1105,9 +1105,9 @@ int render(void)
 
 #define tposval(i)		(tpos[i] < 0 ? n_p + tpos[i] : tpos[i])
 
-static int tpos[NTRAPS];	/* trap positions */
-static int treg[NTRAPS];	/* trap registers */
-static int ntraps;
+static int *tpos;		/* trap positions */
+static int *treg;		/* trap registers */
+static int ntraps, ntraps_sz;
 
 static int trap_first(int pos)
 {
@@ -1154,6 +1154,11 @@ void tr_wh(char **args)
 	reg = map(args[2]);
 	if (id < 0)		/* find an unused position in treg[] */
 		id = trap_byreg(-1);
+	if (id < 0 && ntraps == ntraps_sz) {
+		ntraps_sz = ntraps_sz + 128;
+		tpos = mextend(tpos, ntraps, ntraps_sz, sizeof(tpos[0]));
+		treg = mextend(treg, ntraps, ntraps_sz, sizeof(treg[0]));
+	}
 	if (id < 0)
 		id = ntraps++;
 	tpos[id] = pos;
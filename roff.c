@@ -15,43 +15,11 @@
  * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
-#include <stdarg.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
 #include "roff.h"
 
-void errmsg(char *fmt, ...)
-{
-	va_list ap;
-	va_start(ap, fmt);
-	vfprintf(stderr, fmt, ap);
-	va_end(ap);
-}
-
-void errdie(char *msg)
-{
-	fprintf(stderr, "%s", msg);
-	exit(1);
-}
-
-void *mextend(void *old, long oldsz, long newsz, int memsz)
-{
-	void *new = xmalloc(newsz * memsz);
-	memcpy(new, old, oldsz * memsz);
-	memset(new + oldsz * memsz, 0, (newsz - oldsz) * memsz);
-	free(old);
-	return new;
-}
-
-void *xmalloc(long len)
-{
-	void *m = malloc(len);
-	if (!m)
-		errdie("neatroff: malloc() failed\n");
-	return m;
-}
-
 static int xopens(char *path)
 {
 	FILE *filp = fopen(path, "r");
@@ -94,14 +62,20 @@ static char *usage =
 	"  -C    \tenable compatibility mode\n"
 	"  -Tdev \tset output device\n"
 	"  -Fdir \tset font directory (" TROFFFDIR ")\n"
-	"  -Mdir \tset macro directory (" TROFFMDIR ")\n";
+	"  -Mdir \tset macro directory (" TROFFMDIR ")\n"
+	"  -cdir \tcache compiled fonts in dir\n"
+	"  -jn   \tload device fonts using n threads\n"
+	"  -Hout \tcompile the hyphenation files given as input into out\n";
 
 int main(int argc, char **argv)
 {
 	char *fdir = getenv("NEATROFF_F");	/* fonts directory */
 	char *mdir = getenv("NEATROFF_M");	/* macro packages directory */
 	char *dev = getenv("NEATROFF_T");	/* output device */
+	char *cdir = getenv("NEATROFF_C");	/* compiled fonts directory */
+	char *hout = NULL;	/* compiled hyphenation file */
 	char *mac, *def;
+	int jobs = 1;
 	int reg, ret;
 	int i;
 	if (dev == NULL)
@@ -139,12 +113,24 @@ int main(int argc, char **argv)
 		case 'T':
 			dev = argv[i][2] ? argv[i] + 2 : argv[++i];
 			break;
+		case 'c':
+			cdir = argv[i][2] ? argv[i] + 2 : argv[++i];
+			break;
+		case 'j':
+			jobs = atoi(argv[i][2] ? argv[i] + 2 : argv[++i]);
+			break;
+		case 'H':
+			hout = argv[i][2] ? argv[i] + 2 : argv[++i];
+			break;
 		default:
 			fprintf(stderr, "%s", usage);
 			return 1;
 		}
 	}
-	if (dev_open(fdir, dev)) {
+	if (hout)
+		return hyph_compile(hout, argv + i, argc - i);
+	font_cache(cdir);
+	if (dev_open(fdir, dev, jobs)) {
 		fprintf(stderr, "neatroff: cannot open device %s\n", dev);
 		return 1;
 	}
@@ -15,6 +15,7 @@
  * + font_xyz: fonts (font.c)
  * + sbuf_xyz: variable length string buffers (sbuf.c)
  * + dict_xyz: dictionaries (dict.c)
+ * + trie_xyz: tries (trie.c)
  * + wb_xyz: word buffers (wb.c)
  * + fmt_xyz: line formatting buffers (fmt.c)
  * + n_xyz: builtin number register xyz
@@ -25,27 +26,20 @@
 /* predefined array limits */
 #define PATHLEN		1024	/* path length */
 #define NFILES		16	/* number of input files */
-#define NFONTS		32	/* number of fonts */
 #define FNLEN		32	/* font name length */
 #define GNLEN		32	/* glyph name length */
 #define GNFMT		"%31s"	/* glyph name scanf format */
 #define NMLEN		128	/* macro/register/environment name length */
 #define RNLEN		NMLEN	/* register/macro name */
-#define NREGS		8192	/* number of mapped names */
 #define NARGS		32	/* number of macro arguments */
 #define NPREV		16	/* environment stack depth */
-#define NTRAPS		1024	/* number of traps per page */
 #define NIES		128	/* number of nested .ie commands */
 #define NTABS		32	/* number of tab stops */
-#define NCMAPS		512	/* number of character translations (.tr) */
 #define NSSTR		32	/* number of nested sstr_push() calls */
 #define NFIELDS		32	/* number of fields */
 #define NCHARS		32	/* number of characters for .eos, .hydash, .hystop */
 #define MAXFRAC		100000	/* maximum value of the fractional part */
-#define NCDEFS		128	/* number of character definitions (.char) */
-#define NHYPHS		16384	/* hyphenation dictionary/patterns (.hw) */
 #define NHYPHSWORD	32	/* number of hyphenations per word */
-#define NHCODES		512	/* number of .hcode characters */
 #define WORDLEN		256	/* word length (for hyph.c) */
 #define NFEATS		128	/* number of features per font */
 #define NSCRPS		64	/* number of scripts per font */
@@ -87,6 +81,7 @@ char *num_getfmt(int id);
 void num_setfmt(int id, char *fmt);
 void num_setinc(int id, int val);
 int *nreg(int id);
+void reg_grow(int n);
 int eval(char *s, int unit);
 int eval_up(char **s, int unit);
 int eval_re(char *s, int orig, int unit);
@@ -122,16 +117,32 @@ int *iset_get(struct iset *iset, int key);
 void iset_put(struct iset *iset, int key, int ent);
 int iset_len(struct iset *iset, int key);
 int iset_has(struct iset *iset, int key, int ent);
+void iset_freeze(struct iset *iset);
+
+/* mapping byte strings to integers (tries) */
+struct ptrie {			/* packed tries (double arrays) */
+	int *base;		/* the base of the children of each slot */
+	int *chk;		/* the parent of each slot or -1 */
+	int *val;		/* the value of each slot or -1 */
+	int n;			/* the number of slots */
+};
+
+struct trie *trie_make(void);
+void trie_free(struct trie *t);
+void trie_put(struct trie *t, char *key, int val);
+int trie_get(struct trie *t, char *key);
+struct ptrie *trie_pack(struct trie *t);
+int ptrie_prefix(struct ptrie *pt, char *s, int *vals, int n);
+int ptrie_key(struct ptrie *pt, int s, char *d, int len);
 
 /* mapping strings to longs */
-struct dict *dict_make(int notfound, int dupkeys, int hashlen);
+struct dict *dict_make(int notfound, int dupkeys);
 void dict_free(struct dict *d);
 void dict_put(struct dict *d, char *key, int val);
 int dict_get(struct dict *d, char *key);
 int dict_idx(struct dict *d, char *key);
 char *dict_key(struct dict *d, int idx);
 int dict_val(struct dict *d, int idx);
-int dict_prefix(struct dict *d, char *key, int *idx);
 
 /* device related variables */
 extern int dev_res;
@@ -140,8 +151,8 @@ extern int dev_hor;
 extern int dev_ver;
 
 struct glyph {
-	char id[GNLEN];		/* device-dependent glyph identifier */
-	char name[GNLEN];	/* the first character mapped to this glyph */
+	char *id;		/* device-dependent glyph identifier */
+	char *name;		/* the first character mapped to this glyph */
 	struct font *font;	/* glyph font */
 	short wid;		/* character width */
 	short llx, lly, urx, ury;	/* character bounding box */
@@ -149,17 +160,23 @@ struct glyph {
 };
 
 /* output device functions */
-int dev_open(char *dir, char *dev);
+int dev_open(char *dir, char *dev, int jobs);
 void dev_close(void);
 int dev_mnt(int pos, char *id, char *name);
 int dev_pos(char *id);
 struct font *dev_font(int pos);
 int dev_fontpos(struct font *fn);
 struct glyph *dev_glyph(char *c, int fn);
+void dev_gclear(void);
 
 /* font-related functions */
 struct font *font_open(char *path);
 void font_close(struct font *fn);
+void font_done(void);
+void font_preload(char **paths, int n, int threads);
+void font_cache(char *dir);
+int font_isspecial(char *path);
+void font_lcstat(int *hits, int *misses);
 struct glyph *font_glyph(struct font *fn, char *id);
 struct glyph *font_find(struct font *fn, char *name);
 int font_map(struct font *fn, char *name, char *id);
@@ -168,6 +185,8 @@ int font_special(struct font *fn);
 int font_wid(struct font *fn, int sz, int w);
 int font_gwid(struct font *fn, struct font *cfn, int sz, int w);
 int font_swid(struct font *fn, int sz, int ss);
+int font_glwid(struct glyph *g, struct font *cfn, int sz);
+void font_glbox(struct glyph *g, int sz, int *box);
 void font_setcs(struct font *fn, int cs, int ps);
 int font_getcs(struct font *fn);
 void font_setbd(struct font *fn, int bd);
@@ -307,6 +326,9 @@ void hyphenate(char *hyphs, char *word, int flg);
 int hy_cput(char *d, char *s);
 void hyph_init(void);
 void hyph_done(void);
+void hyph_cstat(int *hits, int *misses);
+int hyph_compile(char *path, char **files, int n);
+char *hyph_lang(int id);
 
 /* adjustment types */
 #define AD_C		0	/* center */
@@ -373,6 +395,8 @@ void tr_hcode(char **args);
 void tr_hpf(char **args);
 void tr_hpfa(char **args);
 void tr_hw(char **args);
+void tr_hla(char **args);
+void tr_hycache(char **args);
 void tr_in(char **args);
 void tr_ll(char **args);
 void tr_mk(char **args);
@@ -435,11 +459,25 @@ void sstr_back(int c);
 
 /* mapping register, macro and environment names to indices */
 #define DOTMAP(c2)	(c2)	/* optimized mapping for ".x" names */
+#define MAPBEG		256	/* the entries reserved for .x names */
 
 int map(char *s);		/* map name s to an index */
 char *map_name(int id);		/* return the name mapped to id */
 void map_done(void);
 
+/* builtin registers with fixed indices; see map_builtin[] in map.c */
+enum {
+	MAP_it = MAPBEG + 1, MAP_itn, MAP_lsn, MAP_nI, MAP_nm, MAP_nM,
+	MAP_nn, MAP_nS, MAP_mc, MAP_mcn, MAP_ct, MAP_td, MAP_cd,
+	MAP_dl, MAP_dn, MAP_ln, MAP_nl, MAP_sb, MAP_st, MAP_pg, MAP_b0,
+	MAP_ce, MAP_f0, MAP_lg, MAP_hy, MAP_hycost, MAP_hycost2,
+	MAP_hycost3, MAP_hlm, MAP_hla, MAP_i0, MAP_ti, MAP_kn, MAP_tI, MAP_I0,
+	MAP_l0, MAP_L0, MAP_m0, MAP_mk, MAP_na, MAP_ns, MAP_o0,
+	MAP_pmll, MAP_pmllcost, MAP_ss, MAP_sss, MAP_ssh, MAP_s0,
+	MAP_sv, MAP_lt, MAP_lt0, MAP_v0, MAP_bbllx, MAP_bblly,
+	MAP_bburx, MAP_bbury, MAP_END
+};
+
 /* text direction */
 extern int dir_do;
 
@@ -462,73 +500,74 @@ int clr_get(char *s);
 #define n_f		(*nreg(DOTMAP('f')))
 #define n_h		(*nreg(DOTMAP('h')))
 #define n_i		(*nreg(DOTMAP('i')))
-#define n_it		(*nreg(map(".it")))	/* .it trap macro */
-#define n_itn		(*nreg(map(".itn")))	/* .it lines left */
+#define n_it		(*nreg(MAP_it))	/* .it trap macro */
+#define n_itn		(*nreg(MAP_itn))	/* .it lines left */
 #define n_I		(*nreg(DOTMAP('I')))	/* base indent */
 #define n_j		(*nreg(DOTMAP('j')))
 #define n_l		(*nreg(DOTMAP('l')))
 #define n_L		(*nreg(DOTMAP('L')))
-#define n_lsn		(*nreg(map("lsn")))	/* for .lsm */
+#define n_lsn		(*nreg(MAP_lsn))	/* for .lsm */
 #define n_n		(*nreg(DOTMAP('n')))
-#define n_nI		(*nreg(map(".nI")))	/* i for .nm */
-#define n_nm		(*nreg(map(".nm")))	/* .nm enabled */
-#define n_nM		(*nreg(map(".nM")))	/* m for .nm */
-#define n_nn		(*nreg(map(".nn")))	/* remaining .nn */
-#define n_nS		(*nreg(map(".nS")))	/* s for .nm */
+#define n_nI		(*nreg(MAP_nI))	/* i for .nm */
+#define n_nm		(*nreg(MAP_nm))	/* .nm enabled */
+#define n_nM		(*nreg(MAP_nM))	/* m for .nm */
+#define n_nn		(*nreg(MAP_nn))	/* remaining .nn */
+#define n_nS		(*nreg(MAP_nS))	/* s for .nm */
 #define n_m		(*nreg(DOTMAP('m')))
-#define n_mc		(*nreg(map(".mc")))	/* .mc enabled */
-#define n_mcn		(*nreg(map(".mcn")))	/* .mc distance */
+#define n_mc		(*nreg(MAP_mc))	/* .mc enabled */
+#define n_mcn		(*nreg(MAP_mcn))	/* .mc distance */
 #define n_o		(*nreg(DOTMAP('o')))
 #define n_p		(*nreg(DOTMAP('p')))
 #define n_s		(*nreg(DOTMAP('s')))
 #define n_u		(*nreg(DOTMAP('u')))
 #define n_v		(*nreg(DOTMAP('v')))
-#define n_ct		(*nreg(map("ct")))
-#define n_td		(*nreg(map(".td")))	/* text direction */
-#define n_cd		(*nreg(map(".cd")))	/* current direction */
-#define n_dl		(*nreg(map("dl")))
-#define n_dn		(*nreg(map("dn")))
-#define n_ln		(*nreg(map("ln")))
-#define n_nl		(*nreg(map("nl")))
-#define n_sb		(*nreg(map("sb")))
-#define n_st		(*nreg(map("st")))
-#define n_pg		(*nreg(map("%")))	/* % */
+#define n_ct		(*nreg(MAP_ct))
+#define n_td		(*nreg(MAP_td))	/* text direction */
+#define n_cd		(*nreg(MAP_cd))	/* current direction */
+#define n_dl		(*nreg(MAP_dl))
+#define n_dn		(*nreg(MAP_dn))
+#define n_ln		(*nreg(MAP_ln))
+#define n_nl		(*nreg(MAP_nl))
+#define n_sb		(*nreg(MAP_sb))
+#define n_st		(*nreg(MAP_st))
+#define n_pg		(*nreg(MAP_pg))	/* % */
 #define n_PG		(*nreg(DOTMAP('%')))	/* number of ejected pages */
-#define n_lb		(*nreg(map(".b0")))	/* input line beg */
-#define n_ce		(*nreg(map(".ce")))	/* .ce remaining */
-#define n_f0		(*nreg(map(".f0")))	/* last .f */
-#define n_lg		(*nreg(map(".lg")))	/* .lg mode */
-#define n_hy		(*nreg(map(".hy")))	/* .hy mode */
-#define n_hycost	(*nreg(map(".hycost")))	/* hyphenation cost */
-#define n_hycost2	(*nreg(map(".hycost2")))	/* hyphenation cost #2 */
-#define n_hycost3	(*nreg(map(".hycost3")))	/* hyphenation cost #3 */
-#define n_hlm		(*nreg(map(".hlm")))	/* .hlm */
-#define n_i0		(*nreg(map(".i0")))	/* last .i */
-#define n_ti		(*nreg(map(".ti")))	/* pending .ti */
-#define n_kn		(*nreg(map(".kn")))	/* .kn mode */
-#define n_tI		(*nreg(map(".tI")))	/* pending .ti2 */
-#define n_I0		(*nreg(map(".I0")))	/* last .I */
-#define n_l0		(*nreg(map(".l0")))	/* last .l */
-#define n_L0		(*nreg(map(".L0")))	/* last .L */
-#define n_m0		(*nreg(map(".m0")))	/* last .m */
-#define n_mk		(*nreg(map(".mk")))	/* .mk internal register */
-#define n_na		(*nreg(map(".na")))	/* .na mode */
-#define n_ns		(*nreg(map(".ns")))	/* .ns mode */
-#define n_o0		(*nreg(map(".o0")))	/* last .o */
-#define n_pmll		(*nreg(map(".pmll")))	/* minimum line length (.pmll) */
-#define n_pmllcost	(*nreg(map(".pmllcost")))	/* short line cost */
-#define n_ss		(*nreg(map(".ss")))	/* word space (.ss) */
-#define n_sss		(*nreg(map(".sss")))	/* sentence space (.ss) */
-#define n_ssh		(*nreg(map(".ssh")))	/* word space compression (.ssh) */
-#define n_s0		(*nreg(map(".s0")))	/* last .s */
-#define n_sv		(*nreg(map(".sv")))	/* .sv value */
-#define n_lt		(*nreg(map(".lt")))	/* .lt value */
-#define n_t0		(*nreg(map(".lt0")))	/* previous .lt value */
-#define n_v0		(*nreg(map(".v0")))	/* last .v */
-#define n_llx		(*nreg(map("bbllx")))	/* \w bounding box */
-#define n_lly		(*nreg(map("bblly")))	/* \w bounding box */
-#define n_urx		(*nreg(map("bburx")))	/* \w bounding box */
-#define n_ury		(*nreg(map("bbury")))	/* \w bounding box */
+#define n_lb		(*nreg(MAP_b0))	/* input line beg */
+#define n_ce		(*nreg(MAP_ce))	/* .ce remaining */
+#define n_f0		(*nreg(MAP_f0))	/* last .f */
+#define n_lg		(*nreg(MAP_lg))	/* .lg mode */
+#define n_hy		(*nreg(MAP_hy))	/* .hy mode */
+#define n_hycost	(*nreg(MAP_hycost))	/* hyphenation cost */
+#define n_hycost2	(*nreg(MAP_hycost2))	/* hyphenation cost #2 */
+#define n_hycost3	(*nreg(MAP_hycost3))	/* hyphenation cost #3 */
+#define n_hlm		(*nreg(MAP_hlm))	/* .hlm */
+#define n_hla		(*nreg(MAP_hla))	/* .hla language index */
+#define n_i0		(*nreg(MAP_i0))	/* last .i */
+#define n_ti		(*nreg(MAP_ti))	/* pending .ti */
+#define n_kn		(*nreg(MAP_kn))	/* .kn mode */
+#define n_tI		(*nreg(MAP_tI))	/* pending .ti2 */
+#define n_I0		(*nreg(MAP_I0))	/* last .I */
+#define n_l0		(*nreg(MAP_l0))	/* last .l */
+#define n_L0		(*nreg(MAP_L0))	/* last .L */
+#define n_m0		(*nreg(MAP_m0))	/* last .m */
+#define n_mk		(*nreg(MAP_mk))	/* .mk internal register */
+#define n_na		(*nreg(MAP_na))	/* .na mode */
+#define n_ns		(*nreg(MAP_ns))	/* .ns mode */
+#define n_o0		(*nreg(MAP_o0))	/* last .o */
+#define n_pmll		(*nreg(MAP_pmll))	/* minimum line length (.pmll) */
+#define n_pmllcost	(*nreg(MAP_pmllcost))	/* short line cost */
+#define n_ss		(*nreg(MAP_ss))	/* word space (.ss) */
+#define n_sss		(*nreg(MAP_sss))	/* sentence space (.ss) */
+#define n_ssh		(*nreg(MAP_ssh))	/* word space compression (.ssh) */
+#define n_s0		(*nreg(MAP_s0))	/* last .s */
+#define n_sv		(*nreg(MAP_sv))	/* .sv value */
+#define n_lt		(*nreg(MAP_lt))	/* .lt value */
+#define n_t0		(*nreg(MAP_lt0))	/* previous .lt value */
+#define n_v0		(*nreg(MAP_v0))	/* last .v */
+#define n_llx		(*nreg(MAP_bbllx))	/* \w bounding box */
+#define n_lly		(*nreg(MAP_bblly))	/* \w bounding box */
+#define n_urx		(*nreg(MAP_bburx))	/* \w bounding box */
+#define n_ury		(*nreg(MAP_bbury))	/* \w bounding box */
 
 /* functions for implementing read-only registers */
 int f_nexttrap(void);	/* .t */
@@ -729,21 +729,23 @@ static void tr_chop(char **args)
 
 /* character translation (.tr) */
 static struct dict *cmap;		/* character mapping */
-static char cmap_src[NCMAPS][GNLEN];	/* source character */
-static char cmap_dst[NCMAPS][GNLEN];	/* character mapping */
-static int cmap_n;			/* number of translated character */
+static char (*cmap_dst)[GNLEN];		/* character mapping */
+static int cmap_n, cmap_sz;		/* number of translated character */
 
 void cmap_add(char *c1, char *c2)
 {
 	int i = dict_get(cmap, c1);
 	if (i >= 0) {
 		strcpy(cmap_dst[i], c2);
-	} else if (cmap_n < NCMAPS) {
-		strcpy(cmap_src[cmap_n], c1);
-		strcpy(cmap_dst[cmap_n], c2);
-		dict_put(cmap, cmap_src[cmap_n], cmap_n);
-		cmap_n++;
+		return;
+	}
+	if (cmap_n == cmap_sz) {
+		cmap_sz = cmap_sz + 128;
+		cmap_dst = mextend(cmap_dst, cmap_n, cmap_sz, sizeof(cmap_dst[0]));
 	}
+	strcpy(cmap_dst[cmap_n], c2);
+	dict_put(cmap, c1, cmap_n);
+	cmap_n++;
 }
 
 char *cmap_map(char *c)
@@ -764,10 +766,10 @@ static void tr_tr(char **args)
 }
 
 /* character definition (.char) */
-static char cdef_src[NCDEFS][GNLEN];	/* source character */
-static char *cdef_dst[NCDEFS];		/* character definition */
-static int cdef_fn[NCDEFS];		/* owning font */
-static int cdef_n;			/* number of defined characters */
+static char (*cdef_src)[GNLEN];		/* source character */
+static char **cdef_dst;			/* character definition */
+static int *cdef_fn;			/* owning font */
+static int cdef_n, cdef_sz;		/* number of defined characters */
 static int cdef_expanding;		/* inside cdef_expand() call */
 
 static int cdef_find(char *c, int fn)
@@ -826,7 +828,16 @@ static void cdef_add(char *fn, char *cs, char *def)
 		for (i = 0; i < cdef_n; i++)
 			if (!cdef_dst[i])
 				break;
-		if (i == cdef_n && cdef_n < NCDEFS)
+		if (i == cdef_sz) {
+			cdef_sz = cdef_sz + 128;
+			cdef_src = mextend(cdef_src, cdef_n, cdef_sz,
+					sizeof(cdef_src[0]));
+			cdef_dst = mextend(cdef_dst, cdef_n, cdef_sz,
+					sizeof(cdef_dst[0]));
+			cdef_fn = mextend(cdef_fn, cdef_n, cdef_sz,
+					sizeof(cdef_fn[0]));
+		}
+		if (i == cdef_n)
 			cdef_n++;
 	}
 	if (i >= 0 && i < cdef_n) {
@@ -866,6 +877,7 @@ static void tr_fmap(char **args)
 	struct font *fn = args[1] ? dev_font(dev_pos(args[1])) : NULL;
 	if (fn && args[2])
 		font_map(fn, args[2], args[3]);
+	dev_gclear();
 }
 
 static void tr_blm(char **args)
@@ -1154,10 +1166,12 @@ static struct cmd {
 	{"fzoom", tr_fzoom},
 	{"hc", tr_hc},
 	{"hcode", tr_hcode},
+	{"hla", tr_hla},
 	{"hlm", tr_hlm},
 	{"hpf", tr_hpf},
 	{"hpfa", tr_hpfa},
 	{"hy", tr_hy},
+	{"hycache", tr_hycache},
 	{"hycost", tr_hycost},
 	{"hydash", tr_hydash},
 	{"hystop", tr_hystop},
@@ -1334,7 +1348,7 @@ void tr_init(void)
 	int i;
 	for (i = 0; i < LEN(cmds); i++)
 		str_dset(map(cmds[i].id), &cmds[i]);
-	cmap = dict_make(-1, 0, 2);
+	cmap = dict_make(-1, 1);
 }
 
 void tr_done(void)
@@ -1342,5 +1356,9 @@ void tr_done(void)
 	int i;
 	for (i = 0; i < cdef_n; i++)
 		free(cdef_dst[i]);
+	free(cdef_src);
+	free(cdef_dst);
+	free(cdef_fn);
+	free(cmap_dst);
 	dict_free(cmap);
 }
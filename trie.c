@@ -0,0 +1,244 @@
+/*
+ * tries mapping byte strings to integers
+ *
+ * Keys are inserted into a linked trie, which is packed into a double
+ * array for lookups: the child of slot s for byte c is slot base[s] + c
+ * if chk[base[s] + c] is s.  The root is slot zero.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "roff.h"
+
+struct trie {
+	/* the insertion trie; children are linked via sib[] */
+	int *kid;		/* the first child of each node */
+	int *sib;		/* the next sibling */
+	unsigned char *chr;	/* the byte leading to each node */
+	int *val;		/* node values or -1 */
+	int n, sz;
+	/* the packed double array */
+	struct ptrie pk;
+	int *pbase;
+	int *pchk;
+	int *pval;
+	int pn, psz;
+	int *pnxt;		/* while packing: the next free slot (if not p) */
+	int dirty;		/* the packed arrays are outdated */
+};
+
+static int trie_node(struct trie *t, int c)
+{
+	if (t->n == t->sz) {
+		int sz = t->sz ? t->sz * 2 : 256;
+		t->kid = mextend(t->kid, t->n, sz, sizeof(t->kid[0]));
+		t->sib = mextend(t->sib, t->n, sz, sizeof(t->sib[0]));
+		t->chr = mextend(t->chr, t->n, sz, sizeof(t->chr[0]));
+		t->val = mextend(t->val, t->n, sz, sizeof(t->val[0]));
+		t->sz = sz;
+	}
+	t->kid[t->n] = -1;
+	t->sib[t->n] = -1;
+	t->chr[t->n] = c;
+	t->val[t->n] = -1;
+	return t->n++;
+}
+
+struct trie *trie_make(void)
+{
+	struct trie *t = xmalloc(sizeof(*t));
+	memset(t, 0, sizeof(*t));
+	trie_node(t, 0);
+	t->dirty = 1;
+	return t;
+}
+
+void trie_free(struct trie *t)
+{
+	free(t->kid);
+	free(t->sib);
+	free(t->chr);
+	free(t->val);
+	free(t->pbase);
+	free(t->pchk);
+	free(t->pval);
+	free(t->pnxt);
+	free(t);
+}
+
+/* the child of node for byte c; create it if mk is nonzero */
+static int trie_kid(struct trie *t, int node, int c, int mk)
+{
+	int k;
+	for (k = t->kid[node]; k >= 0; k = t->sib[k])
+		if (t->chr[k] == c)
+			return k;
+	if (!mk)
+		return -1;
+	k = trie_node(t, c);
+	t->sib[k] = t->kid[node];
+	t->kid[node] = k;
+	return k;
+}
+
+void trie_put(struct trie *t, char *key, int val)
+{
+	int node = 0;
+	while (*key)
+		node = trie_kid(t, node, (unsigned char) *key++, 1);
+	t->val[node] = val;
+	t->dirty = 1;
+}
+
+/* the value of key or -1 */
+int trie_get(struct trie *t, char *key)
+{
+	int node = 0;
+	while (*key && node >= 0)
+		node = trie_kid(t, node, (unsigned char) *key++, 0);
+	return node >= 0 ? t->val[node] : -1;
+}
+
+static void trie_pextend(struct trie *t, int sz)
+{
+	int i;
+	if (sz <= t->psz)
+		return;
+	sz = MAX(sz, t->psz * 2);
+	t->pbase = mextend(t->pbase, t->psz, sz, sizeof(t->pbase[0]));
+	t->pchk = mextend(t->pchk, t->psz, sz, sizeof(t->pchk[0]));
+	t->pval = mextend(t->pval, t->psz, sz, sizeof(t->pval[0]));
+	t->pnxt = mextend(t->pnxt, t->psz, sz, sizeof(t->pnxt[0]));
+	for (i = t->psz; i < sz; i++) {
+		t->pchk[i] = -1;
+		t->pval[i] = -1;
+		t->pnxt[i] = i;
+	}
+	t->psz = sz;
+}
+
+/* the first free slot at or after p */
+static int trie_pfree(struct trie *t, int p)
+{
+	int q = p, r;
+	trie_pextend(t, p + 1);
+	while (t->pnxt[q] != q) {
+		q = t->pnxt[q];
+		trie_pextend(t, q + 1);
+	}
+	while (t->pnxt[p] != p) {	/* path compression */
+		r = t->pnxt[p];
+		t->pnxt[p] = q;
+		p = r;
+	}
+	return q;
+}
+
+/* place the children of node, packed at slot s */
+static int trie_pnode(struct trie *t, int node, int s)
+{
+	int cs[256];
+	int n = 0, b, i, k, p;
+	for (k = t->kid[node]; k >= 0; k = t->sib[k])
+		cs[n++] = t->chr[k];
+	if (!n)
+		return 0;
+	/* the first free slot for cs[0] such that other children fit */
+	for (p = trie_pfree(t, cs[0]); ; p = trie_pfree(t, p + 1)) {
+		b = p - cs[0];
+		trie_pextend(t, b + 256);
+		for (i = 1; i < n; i++)
+			if (t->pchk[b + cs[i]] >= 0)
+				break;
+		if (i == n)
+			break;
+	}
+	t->pbase[s] = b;
+	for (k = t->kid[node]; k >= 0; k = t->sib[k]) {
+		t->pchk[b + t->chr[k]] = s;
+		t->pval[b + t->chr[k]] = t->val[k];
+		t->pnxt[b + t->chr[k]] = b + t->chr[k] + 1;
+		t->pn = MAX(t->pn, b + t->chr[k] + 1);
+	}
+	return b;
+}
+
+/* rebuild the packed double array */
+static void trie_repack(struct trie *t)
+{
+	int *queue = xmalloc(t->n * sizeof(queue[0]));
+	int *slot = xmalloc(t->n * sizeof(slot[0]));
+	int head = 0, tail = 0;
+	int i, k;
+	trie_pextend(t, 257);
+	memset(t->pbase, 0, t->psz * sizeof(t->pbase[0]));
+	memset(t->pchk, 0xff, t->psz * sizeof(t->pchk[0]));
+	memset(t->pval, 0xff, t->psz * sizeof(t->pval[0]));
+	for (i = 0; i < t->psz; i++)
+		t->pnxt[i] = i;
+	t->pchk[0] = 0;
+	t->pnxt[0] = 1;
+	t->pval[0] = t->val[0];
+	t->pn = 1;
+	queue[tail++] = 0;
+	slot[0] = 0;
+	while (head < tail) {
+		int node = queue[head++];
+		int b = trie_pnode(t, node, slot[node]);
+		for (k = t->kid[node]; k >= 0; k = t->sib[k]) {
+			slot[k] = b + t->chr[k];
+			queue[tail++] = k;
+		}
+	}
+	free(queue);
+	free(slot);
+	t->pk.base = t->pbase;
+	t->pk.chk = t->pchk;
+	t->pk.val = t->pval;
+	t->pk.n = t->pn;
+	t->dirty = 0;
+}
+
+/* the packed form of t; valid until t is modified */
+struct ptrie *trie_pack(struct trie *t)
+{
+	if (t->dirty)
+		trie_repack(t);
+	return &t->pk;
+}
+
+/*
+ * find the keys that are prefixes of s
+ *
+ * The values of at most n matching keys are stored in vals[], in the
+ * order of their lengths; the number of matches is returned.
+ */
+int ptrie_prefix(struct ptrie *pt, char *s, int *vals, int n)
+{
+	int node = 0;
+	int cnt = 0;
+	if (pt->val[0] >= 0 && cnt < n)
+		vals[cnt++] = pt->val[0];
+	while (*s) {
+		int next = pt->base[node] + (unsigned char) *s++;
+		if (next >= pt->n || pt->chk[next] != node)
+			break;
+		node = next;
+		if (pt->val[node] >= 0 && cnt < n)
+			vals[cnt++] = pt->val[node];
+	}
+	return cnt;
+}
+
+/* store the key of slot s in d (of size len); return nonzero if too long */
+int ptrie_key(struct ptrie *pt, int s, char *d, int len)
+{
+	int n = 0, p;
+	for (p = s; p; p = pt->chk[p])
+		n++;
+	if (n >= len)
+		return 1;
+	d[n] = '\0';
+	for (p = s; p; p = pt->chk[p])
+		d[--n] = p - pt->base[pt->chk[p]];
+	return 0;
+}
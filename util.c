@@ -0,0 +1,37 @@
+/* helpers shared by neatroff and mkhyen */
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "roff.h"
+
+void errmsg(char *fmt, ...)
+{
+	va_list ap;
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+}
+
+void errdie(char *msg)
+{
+	fprintf(stderr, "%s", msg);
+	exit(1);
+}
+
+void *mextend(void *old, long oldsz, long newsz, int memsz)
+{
+	void *new = xmalloc(newsz * memsz);
+	memcpy(new, old, oldsz * memsz);
+	memset(new + oldsz * memsz, 0, (newsz - oldsz) * memsz);
+	free(old);
+	return new;
+}
+
+void *xmalloc(long len)
+{
+	void *m = malloc(len);
+	if (!m)
+		errdie("neatroff: malloc() failed\n");
+	return m;
+}
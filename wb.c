@@ -174,11 +174,9 @@ static void wb_putbuf(struct wb *wb, char *c)
 	if (!zerowidth) {
 		if (!n_cp && g) {
 			if (g->llx || g->lly || g->urx || g->ury) {
-				int llx = font_wid(g->font, wb->s, g->llx);
-				int lly = font_wid(g->font, wb->s, g->lly);
-				int urx = font_wid(g->font, wb->s, g->urx);
-				int ury = font_wid(g->font, wb->s, g->ury);
-				wb_bbox(wb, llx, lly, urx, ury);
+				int box[4];
+				font_glbox(g, wb->s, box);
+				wb_bbox(wb, box[0], box[1], box[2], box[3]);
 			} else {	/* no bounding box information */
 				int ht = wb->s * SC_PT;
 				int urx = font_wid(g->font, wb->s, g->wid);
@@ -187,7 +185,7 @@ static void wb_putbuf(struct wb *wb, char *c)
 				wb_bbox(wb, 0, lly, urx, ury);
 			}
 		}
-		wb->h += g ? font_gwid(g->font, dev_font(wb->f), wb->s, g->wid) : 0;
+		wb->h += g ? font_glwid(g, dev_font(wb->f), wb->s) : 0;
 		wb->ct |= g ? g->type : 0;
 		wb_stsb(wb);
 	}
@@ -241,7 +239,8 @@ static void wb_flushsub(struct wb *wb)
 		return;
 	wb->sub_collect = 0;
 	fn = dev_font(wb->f);
-	if (!n_hy || wb_hyph(wb->sub_c, wb->sub_n, src_hyph, n_hy))
+	/* words in no-fill or centered text are never broken */
+	if (!n_hy || !n_u || n_ce || wb_hyph(wb->sub_c, wb->sub_n, src_hyph, n_hy))
 		memset(src_hyph, 0, sizeof(src_hyph));
 	/* call font_layout() for collected glyphs; skip hyphenation marks */
 	while (sidx < wb->sub_n) {
@@ -570,7 +569,7 @@ void wb_catstr(struct wb *wb, char *s, char *end)
 int wb_hywid(struct wb *wb)
 {
 	struct glyph *g = dev_glyph("hy", wb->f);
-	return g ? font_gwid(g->font, dev_font(R_F(wb)), R_S(wb), g->wid) : 0;
+	return g ? font_glwid(g, dev_font(R_F(wb)), R_S(wb)) : 0;
 }
 
 /* return the size of space if appended to wb */
@@ -607,8 +606,7 @@ int wb_keshideh(char *word, struct wb *dst, int wid)
 		wb_putc(dst, c, d);
 		if (!c && keshideh(p)) {
 			struct glyph *g = dev_glyph("ـ", R_F(dst));
-			int kw = g ? font_gwid(g->font,
-					dev_font(R_F(dst)), R_S(dst), g->wid) : 0;
+			int kw = g ? font_glwid(g, dev_font(R_F(dst)), R_S(dst)) : 0;
 			if (g && kw < wid) {
 				s_kesh = s_prev;
 				ins = kw;